@@ -0,0 +1,204 @@
+/*
+ * File:			Alarm.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Alarm dispatcher process, runs the actions of the rules
+ *
+ * The measuring processes only detect alarms; everything that may block
+ * (file writes, network, starting a command) happens here, so an action
+ * can not delay the next reading. Notify sends one UDP datagram, exec starts
+ * the command with /bin/sh without waiting for it, both when an alarm is
+ * raised and when it clears; ALARM_RULE, ALARM_STATE (raised or cleared),
+ * ALARM_SENSOR and ALARM_VALUE are set in the command's environment.
+ *
+ * <MIT License>
+ */
+
+#define _GNU_SOURCE				// ppoll
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "Alarm.h"
+
+#define REAPINTERVAL (1)				// s between collecting finished commands
+
+extern volatile bool termSignal;
+extern void getTimeStr ( char * timeStr, size_t len );
+
+typedef struct {
+    uint64_t events;
+    uint64_t failed;					// Actions that could not be started
+    int64_t latencySum;					// ns, sample to dispatched
+    int64_t latencyMax;
+} AlarmStats_t;
+
+static int64_t ElapsedSince ( int64_t realtimeNs ) {
+    return SampleTimeNow () - realtimeNs;
+}
+
+/**
+ * @brief Start a command without waiting for it
+ */
+static int RunCommand ( const char * command, const char * rule, bool raised, int address, int channel, const char * value ) {
+    char sensor[16];
+    sigset_t none;
+    pid_t pid;
+
+    pid = fork ();
+    if ( pid != 0 )
+        return ( pid == -1 ) ? -1 : 0;
+
+    // Ignored and blocked signals would be inherited by the command
+    signal ( SIGINT, SIG_DFL );
+    sigemptyset ( &none );
+    sigprocmask ( SIG_SETMASK, &none, NULL );
+
+    snprintf ( sensor, sizeof ( sensor ), "0x%02x:%d", address, channel );
+    setenv ( "ALARM_RULE", rule, 1 );
+    setenv ( "ALARM_STATE", raised ? "raised" : "cleared", 1 );
+    setenv ( "ALARM_SENSOR", sensor, 1 );
+    setenv ( "ALARM_VALUE", value, 1 );
+    execl ( "/bin/sh", "sh", "-c", command, ( char * ) NULL );
+    _exit ( 127 );
+}
+
+static void Dispatch ( const RuleTable_t * table, const AlarmEvent_t * e, FILE * logFile, int udp[2], AlarmStats_t * stats ) {
+    const RuleAction_t * action = &table->actions[e->rule];
+    char timestamp[40];
+    char message[128];
+    char valueStr[16];
+    Sample_t s;
+    int family;
+    int rv = 0;
+    int64_t latency;
+
+    memset ( &s, 0, sizeof ( s ) );
+    s.value = e->value;
+    s.decimals = e->decimals;
+    SampleFormatValue ( &s, valueStr, sizeof ( valueStr ) );
+    snprintf ( message, sizeof ( message ), "%s %s, sensor 0x%02x:%u, value %s %c", action->name,
+               e->raised ? "raised" : "cleared", e->address, e->channel, valueStr, ( e->unit != '\0' ) ? e->unit : '-' );
+
+    if ( action->action == ACTION_NOTIFY ) {
+        family = ( action->target.ss_family == AF_INET6 ) ? 1 : 0;
+        if ( udp[family] == -1 )
+            udp[family] = socket ( action->target.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0 );
+        if ( ( udp[family] == -1 )
+                || ( sendto ( udp[family], message, strlen ( message ), MSG_DONTWAIT,
+                              ( const struct sockaddr * ) &action->target, action->targetLength ) == -1 ) )
+            rv = -1;
+    } else if ( action->action == ACTION_EXEC ) {
+        rv = RunCommand ( action->command, action->name, e->raised, e->address, e->channel, valueStr );
+    }
+    latency = ElapsedSince ( e->sampleTime );
+
+    stats->events++;
+    stats->latencySum += latency;
+    if ( latency > stats->latencyMax )
+        stats->latencyMax = latency;
+    getTimeStr(timestamp, sizeof(timestamp));
+    if ( rv == -1 ) {
+        stats->failed++;
+        fprintf ( logFile, "%s, %s, action failed: %s\n", timestamp, message, strerror ( errno ) );
+    }
+    fprintf ( logFile, "%s, %s, latency detect: %lld us, dispatch: %lld us\n", timestamp, message,
+              ( long long ) ( ( e->evalTime - e->sampleTime ) / 1000 ), ( long long ) ( latency / 1000 ) );
+}
+
+pid_t AlarmStart ( const RuleTable_t * table, const char * logFileName, int eventSocket[2] ) {
+    struct sigaction ignore;
+    sigset_t block, waitMask;
+    struct pollfd eventPoll;
+    struct timespec reap = { REAPINTERVAL, 0 };
+    AlarmEvent_t event;
+    AlarmStats_t stats = { 0, 0, 0, 0 };
+    int udp[2] = { -1, -1 };
+    char timestamp[40];
+    FILE * logFile;
+    pid_t pid;
+
+    pid = fork ();
+    if ( pid != 0 )
+        return pid;
+
+    // Same signal handling as the measuring processes: SIGTERM is only taken while waiting
+    ignore.sa_handler = SIG_IGN;
+    sigemptyset ( &ignore.sa_mask );
+    ignore.sa_flags = 0;
+    sigaction ( SIGINT, &ignore, NULL );
+    sigemptyset ( &block );
+    sigaddset ( &block, SIGTERM );
+    sigprocmask ( SIG_BLOCK, &block, &waitMask );
+    sigdelset ( &waitMask, SIGTERM );
+
+    close ( eventSocket[0] );
+    logFile = fopen ( logFileName, "a" );
+    if ( logFile == NULL ) {
+        perror ( logFileName );
+        exit ( EXIT_FAILURE );
+    }
+    setvbuf ( logFile, NULL, _IOLBF, 0 );
+
+    eventPoll.fd = eventSocket[1];
+    eventPoll.events = POLLIN;
+    while ( !termSignal ) {
+        ppoll ( &eventPoll, 1, &reap, &waitMask );
+        while ( recv ( eventSocket[1], &event, sizeof ( event ), MSG_DONTWAIT ) == sizeof ( event ) ) {
+            if ( event.rule < table->count )
+                Dispatch ( table, &event, logFile, udp, &stats );
+        }
+        while ( waitpid ( -1, NULL, WNOHANG ) > 0 )
+            ;													// Finished commands
+    }
+    while ( recv ( eventSocket[1], &event, sizeof ( event ), MSG_DONTWAIT ) == sizeof ( event ) ) {
+        if ( event.rule < table->count )
+            Dispatch ( table, &event, logFile, udp, &stats );
+    }
+
+    getTimeStr(timestamp, sizeof(timestamp));
+    fprintf ( logFile, "%s Alarms: %llu, failed actions: %llu, latency mean: %lld us, max: %lld us\n", timestamp,
+              ( unsigned long long ) stats.events, ( unsigned long long ) stats.failed,
+              ( long long ) ( ( stats.events > 0 ) ? stats.latencySum / ( int64_t ) stats.events / 1000 : 0 ),
+              ( long long ) ( stats.latencyMax / 1000 ) );
+    fclose ( logFile );
+    exit ( EXIT_SUCCESS );
+}
+
+bool AlarmStop ( pid_t pid, int drainMs, FILE * logFile ) {
+    struct timespec pause = { 0, 1000000 };				// 1 ms between checks
+    char timestamp[40];
+    int exitStatus;
+    pid_t rv;
+
+    kill ( pid, SIGTERM );
+    for ( int waited = 0; waited <= drainMs; waited++ ) {
+        rv = waitpid ( pid, &exitStatus, WNOHANG );
+        if ( rv == pid ) {
+            getTimeStr(timestamp, sizeof(timestamp));
+            fprintf ( logFile, "%s Alarm dispatcher %d exited with code: %d\n", timestamp, pid,
+                      WIFEXITED ( exitStatus ) ? WEXITSTATUS ( exitStatus ) : -1 );
+            return false;
+        }
+        if ( rv == -1 )
+            return false;										// Not our child
+        nanosleep ( &pause, NULL );
+    }
+    kill ( pid, SIGKILL );
+    waitpid ( pid, &exitStatus, 0 );
+    getTimeStr(timestamp, sizeof(timestamp));
+    fprintf ( logFile, "%s Alarm dispatcher %d killed\n", timestamp, pid );
+    return true;
+}
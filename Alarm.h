@@ -0,0 +1,47 @@
+/*
+ * File:			Alarm.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Alarm dispatcher process, runs the actions of the rules
+ *
+ * <MIT License>
+ */
+
+#ifndef ALARM_H
+#define ALARM_H
+
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "Rules.h"
+
+#define DEFAULTALARMLOG "alarms.txt"
+#define MAXALARMEVENTS (8)				// Events of one sample at most
+
+/**
+ * @brief   Start the dispatcher process
+ *          The measuring processes send AlarmEvent_t datagrams to eventSocket[0]
+ *          without waiting; the dispatcher logs every event to the alarm log and
+ *          runs the action of the rule, for raised and cleared alarms alike. Sample-to-alarm latency is logged
+ *          with every event and summarized when the dispatcher exits.
+ *
+ * @param   table       compiled rules
+ * @param   logFileName alarm log
+ * @param   eventSocket datagram socket pair, side 1 is the dispatcher's
+ * @return  pid_t       dispatcher process, -1 with errno set
+ */
+pid_t AlarmStart ( const RuleTable_t * table, const char * logFileName, int eventSocket[2] );
+
+/**
+ * @brief   Stop the dispatcher after the measuring processes
+ *          Events already sent are dispatched first, until the deadline.
+ *
+ * @param   pid         dispatcher process
+ * @param   drainMs     time to finish
+ * @param   logFile     log file for the exit status
+ * @return  bool        true if it had to be killed
+ */
+bool AlarmStop ( pid_t pid, int drainMs, FILE * logFile );
+
+#endif
@@ -0,0 +1,387 @@
+/*
+ * File:			Archive.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Block compressed archive of measurement samples
+ *
+ * File layout: "SMA1", then blocks. Block header, all fields big endian:
+ *   0  2 bytes marker "BK"
+ *   2  uint16 sensorAddress
+ *   4  uint8  channel
+ *   5  uint8  decimals
+ *   6  char   unit
+ *   7  1 byte reserved (zero)
+ *   8  uint32 count
+ *  12  int64  firstTime (ms)
+ *  20  int64  lastTime (ms)
+ *  28  int32  minValue
+ *  32  int32  maxValue
+ *  36  uint32 payloadBytes
+ * followed by the payload. A near-constant 1 Hz series takes one byte
+ * per sample: both differences fit in their nibble.
+ *
+ * <MIT License>
+ */
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <string.h>
+#include <endian.h>
+
+#include "Archive.h"
+
+#define NIBBLEESCAPE (15)				// Difference follows as varint
+
+static uint64_t ZigZag ( int64_t n ) {
+    return ( ( uint64_t ) n << 1 ) ^ ( uint64_t ) ( n >> 63 );
+}
+
+static int64_t UnZigZag ( uint64_t n ) {
+    return ( int64_t ) ( n >> 1 ) ^ -( int64_t ) ( n & 1 );
+}
+
+static int PutVarint ( uint8_t * buf, uint64_t n ) {
+    int len = 0;
+
+    while ( n >= 0x80 ) {
+        buf[len++] = ( uint8_t ) ( n | 0x80 );
+        n >>= 7;
+    }
+    buf[len++] = ( uint8_t ) n;
+    return len;
+}
+
+/**
+ * @brief Read a varint, -1 if it runs past the end
+ */
+static int GetVarint ( const uint8_t * buf, int len, uint64_t * n ) {
+    int shift = 0;
+
+    *n = 0;
+    for ( int i = 0; ( i < len ) && ( shift < 64 ); i++ ) {
+        *n |= ( uint64_t ) ( buf[i] & 0x7F ) << shift;
+        if ( ( buf[i] & 0x80 ) == 0 )
+            return i + 1;
+        shift += 7;
+    }
+    return -1;
+}
+
+static int WriteFull ( int fd, const uint8_t * buf, size_t len ) {
+    ssize_t n;
+
+    while ( len > 0 ) {
+        n = write ( fd, buf, len );
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read exactly len bytes, returns the bytes read before the end of file
+ */
+static ssize_t ReadFull ( int fd, uint8_t * buf, size_t len ) {
+    size_t done = 0;
+    ssize_t n;
+
+    while ( done < len ) {
+        n = read ( fd, buf + done, len - done );
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+        if ( n == 0 )
+            break;
+        done += n;
+    }
+    return done;
+}
+
+static void PutHeader ( const ArchiveBlockHeader_t * h, uint8_t * buf ) {
+    uint64_t u64;
+    uint32_t u32;
+    uint16_t u16;
+
+    memset ( buf, 0, ARCHIVEBLOCKHEADERSIZE );
+    buf[0] = 'B';
+    buf[1] = 'K';
+    u16 = htobe16 ( h->sensorAddress );
+    memcpy ( buf + 2, &u16, 2 );
+    buf[4] = h->channel;
+    buf[5] = h->decimals;
+    buf[6] = ( uint8_t ) h->unit;
+    u32 = htobe32 ( h->count );
+    memcpy ( buf + 8, &u32, 4 );
+    u64 = htobe64 ( ( uint64_t ) h->firstTime );
+    memcpy ( buf + 12, &u64, 8 );
+    u64 = htobe64 ( ( uint64_t ) h->lastTime );
+    memcpy ( buf + 20, &u64, 8 );
+    u32 = htobe32 ( ( uint32_t ) h->minValue );
+    memcpy ( buf + 28, &u32, 4 );
+    u32 = htobe32 ( ( uint32_t ) h->maxValue );
+    memcpy ( buf + 32, &u32, 4 );
+    u32 = htobe32 ( h->payloadBytes );
+    memcpy ( buf + 36, &u32, 4 );
+}
+
+static int GetHeader ( const uint8_t * buf, ArchiveBlockHeader_t * h ) {
+    uint64_t u64;
+    uint32_t u32;
+    uint16_t u16;
+
+    if ( ( buf[0] != 'B' ) || ( buf[1] != 'K' ) )
+        return -1;
+    memcpy ( &u16, buf + 2, 2 );
+    h->sensorAddress = be16toh ( u16 );
+    h->channel = buf[4];
+    h->decimals = buf[5];
+    h->unit = ( char ) buf[6];
+    memcpy ( &u32, buf + 8, 4 );
+    h->count = be32toh ( u32 );
+    memcpy ( &u64, buf + 12, 8 );
+    h->firstTime = ( int64_t ) be64toh ( u64 );
+    memcpy ( &u64, buf + 20, 8 );
+    h->lastTime = ( int64_t ) be64toh ( u64 );
+    memcpy ( &u32, buf + 28, 4 );
+    h->minValue = ( int32_t ) be32toh ( u32 );
+    memcpy ( &u32, buf + 32, 4 );
+    h->maxValue = ( int32_t ) be32toh ( u32 );
+    memcpy ( &u32, buf + 36, 4 );
+    h->payloadBytes = be32toh ( u32 );
+    if ( ( h->count == 0 ) || ( h->count > ARCHIVEBLOCKSAMPLES ) || ( h->payloadBytes > ARCHIVEMAXPAYLOAD ) )
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Write a block with its header, then empty it
+ *        Header and payload go out in one write, so blocks appended by other
+ *        processes to the same file can not land between them.
+ */
+static int WriteBlock ( ArchiveWriter_t * w, ArchiveBlock_t * b ) {
+    static uint8_t out[ARCHIVEBLOCKHEADERSIZE + ARCHIVEMAXPAYLOAD];
+    size_t len = ARCHIVEBLOCKHEADERSIZE + b->header.payloadBytes;
+
+    if ( b->header.count == 0 )
+        return 0;
+    PutHeader ( &b->header, out );
+    memcpy ( out + ARCHIVEBLOCKHEADERSIZE, b->payload, b->header.payloadBytes );
+    if ( WriteFull ( w->fd, out, len ) == -1 )
+        return -1;
+    w->bytes += len;
+    b->header.count = 0;
+    b->header.payloadBytes = 0;
+    return 0;
+}
+
+int ArchiveOpen ( ArchiveWriter_t * w, const char * path ) {
+    off_t size;
+
+    w->streams = 0;
+    w->samples = 0;
+    w->bytes = 0;
+    w->fd = open ( path, O_WRONLY | O_CREAT | O_APPEND, 0644 );
+    if ( w->fd == -1 )
+        return -1;
+    size = lseek ( w->fd, 0, SEEK_END );
+    if ( ( size == 0 ) && ( WriteFull ( w->fd, ( const uint8_t * ) ARCHIVEMAGIC, ARCHIVEHEADERSIZE ) == -1 ) ) {
+        close ( w->fd );
+        w->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+int ArchiveAppend ( ArchiveWriter_t * w, const Sample_t * s ) {
+    ArchiveBlock_t * b = NULL;
+    int64_t t = s->timestamp / 1000000;
+    int64_t dod, dv;
+    uint64_t zt, zv;
+    uint8_t * out;
+
+    for ( int i = 0; i < w->streams; i++ ) {
+        if ( ( w->blocks[i].header.sensorAddress == s->sensorAddress ) && ( w->blocks[i].header.channel == s->channel ) ) {
+            b = &w->blocks[i];
+            break;
+        }
+    }
+    if ( b == NULL ) {
+        if ( w->streams == MAXARCHIVESTREAMS ) {						// Rare, start over with the new set
+            if ( ArchiveFlush ( w ) == -1 )
+                return -1;
+            w->streams = 0;
+        }
+        b = &w->blocks[w->streams++];
+        b->header.sensorAddress = s->sensorAddress;
+        b->header.channel = s->channel;
+        b->header.count = 0;
+        b->header.payloadBytes = 0;
+    }
+    // A block is full, spans too long or the clock went back
+    if ( ( b->header.count > 0 )
+            && ( ( b->header.count == ARCHIVEBLOCKSAMPLES ) || ( t - b->header.firstTime >= ARCHIVEBLOCKSPAN )
+                 || ( t < b->prevTime ) || ( s->decimals != b->header.decimals ) || ( s->unit != b->header.unit ) ) ) {
+        if ( WriteBlock ( w, b ) == -1 )
+            return -1;
+    }
+    if ( b->header.count == 0 ) {
+        b->header.decimals = s->decimals;
+        b->header.unit = s->unit;
+        b->header.firstTime = t;
+        b->header.minValue = s->value;
+        b->header.maxValue = s->value;
+        b->prevTime = t;
+        b->prevDelta = 0;
+        b->prevValue = 0;
+    }
+
+    dod = ( t - b->prevTime ) - b->prevDelta;
+    dv = ( int64_t ) s->value - b->prevValue;
+    b->prevDelta = t - b->prevTime;
+    b->prevTime = t;
+    b->prevValue = s->value;
+
+    zt = ZigZag ( dod );
+    zv = ZigZag ( dv );
+    out = b->payload + b->header.payloadBytes;
+    *out = ( uint8_t ) ( ( ( zt < NIBBLEESCAPE ) ? zt : NIBBLEESCAPE ) << 4 | ( ( zv < NIBBLEESCAPE ) ? zv : NIBBLEESCAPE ) );
+    out++;
+    if ( zt >= NIBBLEESCAPE )
+        out += PutVarint ( out, zt );
+    if ( zv >= NIBBLEESCAPE )
+        out += PutVarint ( out, zv );
+    b->header.payloadBytes = out - b->payload;
+
+    b->header.lastTime = t;
+    if ( s->value < b->header.minValue )
+        b->header.minValue = s->value;
+    if ( s->value > b->header.maxValue )
+        b->header.maxValue = s->value;
+    b->header.count++;
+    w->samples++;
+    return 0;
+}
+
+int ArchiveFlush ( ArchiveWriter_t * w ) {
+    for ( int i = 0; i < w->streams; i++ ) {
+        if ( WriteBlock ( w, &w->blocks[i] ) == -1 )
+            return -1;
+    }
+    return 0;
+}
+
+int ArchiveClose ( ArchiveWriter_t * w ) {
+    int rv = 0;
+
+    if ( w->fd == -1 )
+        return 0;
+    if ( ( ArchiveFlush ( w ) == -1 ) || ( fdatasync ( w->fd ) == -1 ) )
+        rv = -1;
+    close ( w->fd );
+    w->fd = -1;
+    return rv;
+}
+
+uint64_t ArchiveUnwritten ( const ArchiveWriter_t * w ) {
+    uint64_t unwritten = 0;
+
+    for ( int i = 0; i < w->streams; i++ )
+        unwritten += w->blocks[i].header.count;
+    return unwritten;
+}
+
+int ArchiveReaderOpen ( ArchiveReader_t * r, const char * path ) {
+    uint8_t magic[ARCHIVEHEADERSIZE];
+
+    r->payloadRead = true;
+    r->header.payloadBytes = 0;
+    r->fd = open ( path, O_RDONLY );
+    if ( r->fd == -1 )
+        return -1;
+    if ( ( ReadFull ( r->fd, magic, sizeof ( magic ) ) != sizeof ( magic ) )
+            || ( memcmp ( magic, ARCHIVEMAGIC, ARCHIVEHEADERSIZE ) != 0 ) ) {
+        close ( r->fd );
+        r->fd = -1;
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+int ArchiveNextBlock ( ArchiveReader_t * r ) {
+    uint8_t header[ARCHIVEBLOCKHEADERSIZE];
+    ssize_t n;
+
+    if ( !r->payloadRead && ( lseek ( r->fd, r->header.payloadBytes, SEEK_CUR ) == -1 ) )
+        return -1;
+    n = ReadFull ( r->fd, header, sizeof ( header ) );
+    if ( n == 0 )
+        return 0;
+    if ( ( n != sizeof ( header ) ) || ( GetHeader ( header, &r->header ) == -1 ) )
+        return -1;
+    r->payloadRead = false;
+    return 1;
+}
+
+int ArchiveReadBlock ( ArchiveReader_t * r, Sample_t * samples ) {
+    if ( ReadFull ( r->fd, r->payload, r->header.payloadBytes ) != ( ssize_t ) r->header.payloadBytes )
+        return -1;
+    r->payloadRead = true;
+    return ArchiveDecode ( &r->header, r->payload, samples );
+}
+
+void ArchiveReaderClose ( ArchiveReader_t * r ) {
+    if ( r->fd != -1 )
+        close ( r->fd );
+    r->fd = -1;
+}
+
+int ArchiveDecode ( const ArchiveBlockHeader_t * header, const uint8_t * payload, Sample_t * samples ) {
+    const uint8_t * end = payload + header->payloadBytes;
+    int64_t t = header->firstTime;
+    int64_t delta = 0;
+    int64_t value = 0;
+    uint64_t zt, zv;
+    int n;
+
+    for ( uint32_t i = 0; i < header->count; i++ ) {
+        if ( payload >= end )
+            return -1;
+        zt = *payload >> 4;
+        zv = *payload & 0x0F;
+        payload++;
+        if ( zt == NIBBLEESCAPE ) {
+            if ( ( n = GetVarint ( payload, end - payload, &zt ) ) == -1 )
+                return -1;
+            payload += n;
+        }
+        if ( zv == NIBBLEESCAPE ) {
+            if ( ( n = GetVarint ( payload, end - payload, &zv ) ) == -1 )
+                return -1;
+            payload += n;
+        }
+        delta += UnZigZag ( zt );
+        t += delta;
+        value += UnZigZag ( zv );
+
+        samples[i].timestamp = t * 1000000;
+        samples[i].seq = i;
+        samples[i].value = ( int32_t ) value;
+        samples[i].sensorAddress = header->sensorAddress;
+        samples[i].channel = header->channel;
+        samples[i].decimals = header->decimals;
+        samples[i].unit = header->unit;
+    }
+    return header->count;
+}
@@ -0,0 +1,160 @@
+/*
+ * File:			Archive.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Block compressed archive of measurement samples
+ *
+ * <MIT License>
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Sample.h"
+
+#define ARCHIVEMAGIC "SMA1"				// File header, also the format version
+#define ARCHIVEHEADERSIZE (4)
+#define ARCHIVEBLOCKHEADERSIZE (40)		// Size of a block header in the file
+#define ARCHIVEBLOCKSAMPLES (1024)		// Samples per block at most
+#define ARCHIVEBLOCKSPAN (600000)		// ms, a block is closed when it covers this much time
+#define ARCHIVEMAXPAYLOAD (ARCHIVEBLOCKSAMPLES * 16)	// Worst case payload of a block
+#define MAXARCHIVESTREAMS (8)			// Sensor channels one writer keeps blocks open for
+
+/*
+ * A block holds the samples of one sensor channel. The header carries the
+ * time range and the value range, so readers skip blocks without decoding.
+ * Timestamps are stored in ms: the first one in the header, then the delta
+ * and the delta of deltas. Values are stored as deltas. Each sample starts
+ * with a byte of two nibbles, zigzag coded time and value difference; a
+ * nibble of 15 means the difference follows as a zigzag varint.
+ */
+typedef struct {
+    uint16_t sensorAddress;
+    uint8_t channel;
+    uint8_t decimals;
+    char unit;
+    uint32_t count;						// Samples in the block
+    int64_t firstTime;					// ms since epoch
+    int64_t lastTime;					// ms since epoch
+    int32_t minValue;
+    int32_t maxValue;
+    uint32_t payloadBytes;
+} ArchiveBlockHeader_t;
+
+typedef struct {
+    ArchiveBlockHeader_t header;
+    int64_t prevTime;
+    int64_t prevDelta;
+    int32_t prevValue;
+    uint8_t payload[ARCHIVEMAXPAYLOAD];
+} ArchiveBlock_t;
+
+typedef struct {
+    int fd;
+    int streams;						// Open blocks
+    ArchiveBlock_t blocks[MAXARCHIVESTREAMS];
+    uint64_t samples;					// Samples archived
+    uint64_t bytes;						// Bytes written
+} ArchiveWriter_t;
+
+typedef struct {
+    int fd;
+    ArchiveBlockHeader_t header;		// Header of the current block
+    bool payloadRead;
+    uint8_t payload[ARCHIVEMAXPAYLOAD];
+} ArchiveReader_t;
+
+/**
+ * @brief   Open an archive for appending, create it if needed
+ *
+ * @param   w       writer state
+ * @param   path    archive file
+ * @return  int     0 on success, -1 with errno set
+ */
+int ArchiveOpen ( ArchiveWriter_t * w, const char * path );
+
+/**
+ * @brief   Add a sample, a full block is written to the file
+ *          Samples of a channel must come in time order.
+ *
+ * @param   w       writer state
+ * @param   s       sample
+ * @return  int     0 on success, -1 with errno set on write error
+ */
+int ArchiveAppend ( ArchiveWriter_t * w, const Sample_t * s );
+
+/**
+ * @brief   Write the open blocks to the file, even if not full
+ *
+ * @param   w       writer state
+ * @return  int     0 on success, -1 with errno set on write error
+ */
+int ArchiveFlush ( ArchiveWriter_t * w );
+
+/**
+ * @brief   Flush and close the archive
+ *
+ * @param   w       writer state
+ * @return  int     0 on success, -1 with errno set on write error
+ */
+int ArchiveClose ( ArchiveWriter_t * w );
+
+/**
+ * @brief   Samples appended but not in the file yet, after a failed close
+ *          these are lost
+ *
+ * @param   w       writer state
+ * @return  uint64_t
+ */
+uint64_t ArchiveUnwritten ( const ArchiveWriter_t * w );
+
+/**
+ * @brief   Open an archive for reading
+ *
+ * @param   r       reader state
+ * @param   path    archive file
+ * @return  int     0 on success, -1 with errno set, EINVAL if it is not an archive
+ */
+int ArchiveReaderOpen ( ArchiveReader_t * r, const char * path );
+
+/**
+ * @brief   Read the header of the next block
+ *          The payload of the previous block is skipped if it was not decoded.
+ *
+ * @param   r       reader state
+ * @return  int     1 if there is a block, 0 at the end of the file, -1 on a damaged file
+ */
+int ArchiveNextBlock ( ArchiveReader_t * r );
+
+/**
+ * @brief   Read and decode the current block
+ *
+ * @param   r       reader state
+ * @param   samples output, room for ARCHIVEBLOCKSAMPLES samples
+ * @return  int     number of samples, -1 on a damaged block
+ */
+int ArchiveReadBlock ( ArchiveReader_t * r, Sample_t * samples );
+
+/**
+ * @brief   Close the archive
+ *
+ * @param   r       reader state
+ */
+void ArchiveReaderClose ( ArchiveReader_t * r );
+
+/**
+ * @brief   Decode a block payload in memory
+ *          The sequence numbers are the positions in the block.
+ *
+ * @param   header  block header
+ * @param   payload payload bytes
+ * @param   samples output, room for header->count samples
+ * @return  int     number of samples, -1 if the payload is damaged
+ */
+int ArchiveDecode ( const ArchiveBlockHeader_t * header, const uint8_t * payload, Sample_t * samples );
+
+#endif
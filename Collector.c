@@ -0,0 +1,419 @@
+/*
+ * File:			Collector.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Collector mode, merges the sample streams of many SensorMaster servers
+ *
+ * <MIT License>
+ */
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <poll.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Net.h"
+#include "Sample.h"
+#include "Collector.h"
+
+#define BOARD_IDLE (0)
+#define BOARD_CONNECTING (1)
+#define BOARD_CONNECTED (2)
+
+#define MINBACKOFF (500)				// ms, first reconnect delay
+#define MAXBACKOFF (30000)				// ms, reconnect delay limit
+#define POLLTIMEOUT (100)				// ms
+#define MAXLINELENGTH 128
+
+extern volatile bool quitSignal;
+extern volatile bool termSignal;
+extern char serverPort[MAXPORTLENGTH];
+extern void getTimeStr ( char * timeStr, size_t len );
+
+typedef struct {
+    char host[MAXHOSTLENGTH];
+    char port[MAXPORTLENGTH];			// Stream port
+    char name[MAXHOSTLENGTH + MAXPORTLENGTH];
+    int fd;
+    int state;
+    int64_t retryAt;					// Next connection attempt (ns)
+    int backoff;						// Current reconnect delay (ms)
+    unsigned char partial[SAMPLEWIRESIZE];	// Incomplete record from last read
+    size_t partialLen;
+    Sample_t buf[REORDERDEPTH];			// Reorder buffer, sorted by timestamp
+    int head;
+    int count;
+    int heapPos;						// Position in merge heap, -1 if not in heap
+    int64_t newest;						// Timestamp of newest received sample
+    uint64_t received;
+    uint64_t late;						// Samples older than already merged ones
+    uint64_t reconnects;
+} Board_t;
+
+// Static state keeps memory flat regardless of board count and data rate
+static Board_t boards[MAXBOARDS];
+static int boardCount;
+static int heap[MAXBOARDS];				// Min-heap of boards with buffered samples, keyed by head timestamp
+static int heapSize;
+static int connectedBoards;
+static int connectedWithData;			// Connected boards with at least one buffered sample
+static int64_t lastMerged;
+static uint64_t mergedTotal;
+static FILE * store;
+static FILE * logFile;
+
+static int64_t HeadTime ( int b ) {
+    return boards[b].buf[boards[b].head].timestamp;
+}
+
+static void HeapSwap ( int i, int j ) {
+    int t = heap[i];
+    heap[i] = heap[j];
+    heap[j] = t;
+    boards[heap[i]].heapPos = i;
+    boards[heap[j]].heapPos = j;
+}
+
+static void HeapUp ( int i ) {
+    while ( ( i > 0 ) && ( HeadTime ( heap[( i - 1 ) / 2] ) > HeadTime ( heap[i] ) ) ) {
+        HeapSwap ( i, ( i - 1 ) / 2 );
+        i = ( i - 1 ) / 2;
+    }
+}
+
+static void HeapDown ( int i ) {
+    int smallest;
+
+    for ( ;; ) {
+        smallest = i;
+        if ( ( 2 * i + 1 < heapSize ) && ( HeadTime ( heap[2 * i + 1] ) < HeadTime ( heap[smallest] ) ) )
+            smallest = 2 * i + 1;
+        if ( ( 2 * i + 2 < heapSize ) && ( HeadTime ( heap[2 * i + 2] ) < HeadTime ( heap[smallest] ) ) )
+            smallest = 2 * i + 2;
+        if ( smallest == i )
+            return;
+        HeapSwap ( i, smallest );
+        i = smallest;
+    }
+}
+
+static void HeapRemove ( int b ) {
+    int i = boards[b].heapPos;
+
+    heapSize--;
+    if ( i != heapSize ) {
+        heap[i] = heap[heapSize];
+        boards[heap[i]].heapPos = i;
+        HeapUp ( i );
+        HeapDown ( boards[heap[i]].heapPos );
+    }
+    boards[b].heapPos = -1;
+}
+
+/**
+ * @brief Write the oldest buffered sample of all boards to the store
+ */
+static void EmitOldest ( void ) {
+    int b = heap[0];
+    Board_t * board = &boards[b];
+    Sample_t * s = &board->buf[board->head];
+    char value[24];
+
+    if ( s->timestamp < lastMerged )
+        board->late++;
+    else
+        lastMerged = s->timestamp;
+
+    SampleFormatValue ( s, value, sizeof ( value ) );
+    fprintf ( store, "%lld.%03lld, %s, 0x%02x, %u, %u, %s, %c\n",
+              ( long long ) ( s->timestamp / 1000000000LL ), ( long long ) ( ( s->timestamp / 1000000LL ) % 1000 ),
+              board->name, s->sensorAddress, s->channel, s->seq, value, ( s->unit != '\0' ) ? s->unit : '-' );
+    mergedTotal++;
+
+    board->head = ( board->head + 1 ) % REORDERDEPTH;
+    board->count--;
+    if ( board->count == 0 ) {
+        HeapRemove ( b );
+        if ( board->state == BOARD_CONNECTED )
+            connectedWithData--;
+    } else
+        HeapDown ( 0 );
+}
+
+/**
+ * @brief Insert a sample into the sorted reorder buffer of a board
+ */
+static void BoardInsert ( int b, const Sample_t * s ) {
+    Board_t * board = &boards[b];
+    int pos;
+
+    while ( board->count == REORDERDEPTH )		// Buffer full, merge forward to make room
+        EmitOldest ();
+
+    // Samples mostly arrive in order, search backwards from the tail
+    pos = board->count;
+    while ( ( pos > 0 ) && ( board->buf[( board->head + pos - 1 ) % REORDERDEPTH].timestamp > s->timestamp ) ) {
+        board->buf[( board->head + pos ) % REORDERDEPTH] = board->buf[( board->head + pos - 1 ) % REORDERDEPTH];
+        pos--;
+    }
+    board->buf[( board->head + pos ) % REORDERDEPTH] = *s;
+    board->count++;
+
+    if ( s->timestamp > board->newest )
+        board->newest = s->timestamp;
+    board->received++;
+
+    if ( board->heapPos == -1 ) {
+        connectedWithData++;					// Only connected boards receive samples
+        heap[heapSize] = b;
+        board->heapPos = heapSize++;
+        HeapUp ( board->heapPos );
+    } else if ( pos == 0 ) {
+        HeapUp ( board->heapPos );				// New head is older
+    }
+}
+
+/**
+ * @brief Merge every sample that can not be preceded by a sample still to come
+ *        A sample is safe when every connected board has data buffered, or when it is
+ *        older than the reorder window (silent boards do not stall the others).
+ */
+static void Merge ( int64_t now, int64_t window ) {
+    while ( heapSize > 0 ) {
+        if ( ( connectedWithData == connectedBoards ) || ( HeadTime ( heap[0] ) <= now - window ) )
+            EmitOldest ();
+        else
+            break;
+    }
+}
+
+static void BoardDisconnect ( int b, int64_t now, const char * reason ) {
+    Board_t * board = &boards[b];
+    char timestamp[40];
+
+    if ( board->state == BOARD_CONNECTED ) {
+        connectedBoards--;
+        if ( board->count > 0 )
+            connectedWithData--;
+    }
+    if ( board->fd != -1 )
+        close ( board->fd );
+    board->fd = -1;
+    board->state = BOARD_IDLE;
+    board->partialLen = 0;
+    board->retryAt = now + ( int64_t ) board->backoff * 1000000LL;
+    board->backoff = ( board->backoff * 2 > MAXBACKOFF ) ? MAXBACKOFF : board->backoff * 2;
+
+    getTimeStr ( timestamp, sizeof ( timestamp ) );
+    fprintf ( logFile, "%s, %s, disconnected: %s\n", timestamp, board->name, reason );
+}
+
+static void BoardConnected ( int b ) {
+    Board_t * board = &boards[b];
+    char timestamp[40];
+
+    board->state = BOARD_CONNECTED;
+    board->backoff = MINBACKOFF;
+    board->reconnects++;
+    connectedBoards++;
+    if ( board->count > 0 )
+        connectedWithData++;
+
+    getTimeStr ( timestamp, sizeof ( timestamp ) );
+    fprintf ( logFile, "%s, %s, connected\n", timestamp, board->name );
+}
+
+static void BoardRead ( int b, int64_t now ) {
+    Board_t * board = &boards[b];
+    unsigned char data[64 * SAMPLEWIRESIZE];
+    Sample_t s;
+    ssize_t n;
+    size_t off;
+
+    for ( ;; ) {
+        memcpy ( data, board->partial, board->partialLen );
+        n = recv ( board->fd, data + board->partialLen, sizeof ( data ) - board->partialLen, MSG_DONTWAIT );
+        if ( n == 0 ) {
+            BoardDisconnect ( b, now, "closed by server" );
+            return;
+        }
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            if ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) )
+                BoardDisconnect ( b, now, strerror ( errno ) );
+            return;
+        }
+        n += board->partialLen;
+        for ( off = 0; off + SAMPLEWIRESIZE <= ( size_t ) n; off += SAMPLEWIRESIZE ) {
+            SampleDecode ( data + off, &s );
+            BoardInsert ( b, &s );
+        }
+        board->partialLen = n - off;
+        memcpy ( board->partial, data + off, board->partialLen );
+        if ( ( size_t ) n < sizeof ( data ) )
+            return;
+    }
+}
+
+static void ReportLag ( int64_t now ) {
+    char timestamp[40];
+    int64_t lag, maxLag = 0;
+    int maxLagBoard = -1;
+
+    getTimeStr ( timestamp, sizeof ( timestamp ) );
+    for ( int b = 0; b < boardCount; b++ ) {
+        lag = ( boards[b].newest == 0 ) ? -1 : ( now - boards[b].newest ) / 1000000LL;
+        fprintf ( logFile, "%s, %s, %s, lag %lld ms, received %llu, buffered %d, late %llu, connects %llu\n",
+                  timestamp, boards[b].name, ( boards[b].state == BOARD_CONNECTED ) ? "up" : "down", ( long long ) lag,
+                  ( unsigned long long ) boards[b].received, boards[b].count,
+                  ( unsigned long long ) boards[b].late, ( unsigned long long ) boards[b].reconnects );
+        if ( ( boards[b].state == BOARD_CONNECTED ) && ( lag > maxLag ) ) {
+            maxLag = lag;
+            maxLagBoard = b;
+        }
+    }
+    printf ( "%s Boards connected: %d/%d, merged: %llu, max lag: %lld ms%s%s\n", timestamp, connectedBoards, boardCount,
+             ( unsigned long long ) mergedTotal, ( long long ) maxLag,
+             ( maxLagBoard == -1 ) ? "" : " at ", ( maxLagBoard == -1 ) ? "" : boards[maxLagBoard].name );
+    fflush ( store );
+    fflush ( logFile );
+}
+
+static int ReadBoardList ( const char * boardListFile ) {
+    FILE * listFile;
+    char textRow[MAXLINELENGTH];
+    char host[MAXHOSTLENGTH];
+    char port[MAXPORTLENGTH];
+    Board_t * board;
+
+    listFile = fopen ( boardListFile, "r" );
+    if ( listFile == NULL ) {
+        perror ( "boardlist" );
+        return -1;
+    }
+    boardCount = 0;
+    while ( fgets ( textRow, MAXLINELENGTH, listFile ) != NULL ) {
+        if ( ( textRow[0] == '#' ) || ( strspn ( textRow, " \t\r\n" ) == strlen ( textRow ) ) )
+            continue;
+        if ( boardCount == MAXBOARDS ) {
+            printf ( "Too many boards, only the first %d are collected.\n", MAXBOARDS );
+            break;
+        }
+        board = &boards[boardCount];
+        if ( NetParseTarget ( textRow, host, port, serverPort ) == -1 ) {
+            printf ( "Invalid board address: %s", textRow );
+            continue;
+        }
+        // The name is built from the local copies, not from fields of the same board
+        memcpy ( board->host, host, sizeof ( board->host ) );
+        NetStreamPort ( port, board->port );
+        snprintf ( board->name, sizeof ( board->name ), "%s:%s", host, port );
+        board->fd = -1;
+        board->state = BOARD_IDLE;
+        board->backoff = MINBACKOFF;
+        board->heapPos = -1;
+        boardCount++;
+    }
+    fclose ( listFile );
+    return boardCount;
+}
+
+int RunCollector ( const char * boardListFile, const char * storeFile, int windowMs, FILE * masterLogfile ) {
+    static struct pollfd pfds[MAXBOARDS];
+    static int pfdBoard[MAXBOARDS];
+    int nfds;
+    int64_t now, nextReport;
+    int rv, err;
+
+    logFile = masterLogfile;
+    if ( ReadBoardList ( boardListFile ) <= 0 ) {
+        printf ( "No boards to collect from.\n" );
+        return EXIT_FAILURE;
+    }
+    store = fopen ( storeFile, "a+" );
+    if ( store == NULL ) {
+        perror ( "store" );
+        return EXIT_FAILURE;
+    }
+    printf ( "Collecting from %d boards into %s\n", boardCount, storeFile );
+
+    now = SampleTimeNow ();
+    nextReport = now + LAGREPORTINTERVAL * 1000000000LL;
+
+    while ( !quitSignal && !termSignal ) {
+        now = SampleTimeNow ();
+
+        // Start connections that are due
+        for ( int b = 0; b < boardCount; b++ ) {
+            if ( ( boards[b].state != BOARD_IDLE ) || ( boards[b].retryAt > now ) )
+                continue;
+            rv = NetConnectStart ( boards[b].host, boards[b].port, &boards[b].fd );
+            if ( rv == 0 ) {
+                BoardConnected ( b );
+            } else if ( rv == 1 ) {
+                boards[b].state = BOARD_CONNECTING;
+            } else {
+                BoardDisconnect ( b, now, "connect failed" );
+            }
+        }
+
+        nfds = 0;
+        for ( int b = 0; b < boardCount; b++ ) {
+            if ( boards[b].state == BOARD_IDLE )
+                continue;
+            pfds[nfds].fd = boards[b].fd;
+            pfds[nfds].events = ( boards[b].state == BOARD_CONNECTING ) ? POLLOUT : POLLIN;
+            pfds[nfds].revents = 0;
+            pfdBoard[nfds] = b;
+            nfds++;
+        }
+
+        rv = poll ( pfds, nfds, POLLTIMEOUT );
+        if ( ( rv == -1 ) && ( errno != EINTR ) ) {
+            perror ( "poll" );
+            break;
+        }
+        now = SampleTimeNow ();
+
+        for ( int i = 0; ( rv > 0 ) && ( i < nfds ); i++ ) {
+            int b = pfdBoard[i];
+            if ( pfds[i].revents == 0 )
+                continue;
+            if ( boards[b].state == BOARD_CONNECTING ) {
+                if ( ( err = NetConnectResult ( boards[b].fd ) ) == 0 )
+                    BoardConnected ( b );
+                else
+                    BoardDisconnect ( b, now, strerror ( err ) );
+            } else {
+                BoardRead ( b, now );
+            }
+        }
+
+        Merge ( now, ( int64_t ) windowMs * 1000000LL );
+
+        if ( now >= nextReport ) {
+            ReportLag ( now );
+            nextReport += LAGREPORTINTERVAL * 1000000000LL;
+        }
+    }
+
+    // Flush everything still buffered
+    while ( heapSize > 0 )
+        EmitOldest ();
+    ReportLag ( SampleTimeNow () );
+    for ( int b = 0; b < boardCount; b++ ) {
+        if ( boards[b].fd != -1 )
+            close ( boards[b].fd );
+    }
+    fclose ( store );
+    return EXIT_SUCCESS;
+}
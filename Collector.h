@@ -0,0 +1,37 @@
+/*
+ * File:			Collector.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Collector mode, merges the sample streams of many SensorMaster servers
+ *
+ * <MIT License>
+ */
+
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include <stdio.h>
+
+#define MAXBOARDS (512)					// Boards per collector
+#define REORDERDEPTH (32)				// Samples buffered per board for reordering
+#define DEFAULTREORDERWINDOW (2000)		// ms to wait for a silent board before merging past it
+#define LAGREPORTINTERVAL (10)			// s between per-board lag reports
+
+/**
+ * @brief   Run the collector until SIGINT or SIGTERM
+ *          Reads board list (one "host[:port]" per line, '#' comments, port is
+ *          the command port of the board, the stream is read from port + 1),
+ *          keeps a connection to the sample stream of every board and
+ *          writes the samples in time order to the store file.
+ *          Memory use does not depend on the data rate, only on MAXBOARDS.
+ *
+ * @param   boardListFile   file containing the board list
+ * @param   storeFile       merged output file
+ * @param   windowMs        reorder window in milliseconds
+ * @param   masterLogfile   log for connection events and lag reports
+ * @return  int             EXIT_SUCCESS or EXIT_FAILURE
+ */
+int RunCollector ( const char * boardListFile, const char * storeFile, int windowMs, FILE * masterLogfile );
+
+#endif
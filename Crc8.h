@@ -0,0 +1,26 @@
+/*
+ * File:			Crc8.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		CRC-8 used by Sensirion sensors (polynomial 0x31, init 0xFF)
+ *
+ * <MIT License>
+ */
+
+#ifndef CRC8_H
+#define CRC8_H
+
+#include <stdint.h>
+
+/**
+ * @brief   Table driven CRC-8 of a data block
+ *          CRC of 0xBE 0xEF is 0x92.
+ *
+ * @param   data    data bytes
+ * @param   len     number of bytes
+ * @return  uint8_t
+ */
+uint8_t Crc8 ( const uint8_t * data, int len );
+
+#endif
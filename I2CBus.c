@@ -0,0 +1,83 @@
+/*
+ * File:			I2CBus.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		I2C bus access with bounded transfer time, real or simulated
+ *
+ * <MIT License>
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#include <string.h>
+
+#include "I2CBus.h"
+
+int BusOpen ( I2CBus_t * bus, const char * path, int address, int timeoutMs, int simModel, int simFail, int simWave ) {
+    int saved;
+
+    strncpy ( bus->path, path, MAXBUSNAMELENGTH );
+    bus->path[MAXBUSNAMELENGTH - 1] = '\0';
+    bus->address = address;
+    bus->timeout = timeoutMs;
+    bus->fd = -1;
+    bus->simulated = ( strcmp ( path, SIMBUS ) == 0 );
+
+    if ( bus->simulated ) {
+        SimInit ( &bus->sim, simModel, address, simFail, simWave );
+        bus->fd = 0;
+        return 0;
+    }
+
+    bus->fd = open ( path, O_RDWR );
+    if ( bus->fd == -1 )
+        return -1;
+    if ( ( ioctl ( bus->fd, I2C_SLAVE, address ) == -1 )
+            || ( ioctl ( bus->fd, I2C_TIMEOUT, ( timeoutMs + 9 ) / 10 ) == -1 )		// Unit is 10 ms
+            || ( ioctl ( bus->fd, I2C_RETRIES, 0 ) == -1 ) ) {
+        saved = errno;
+        close ( bus->fd );
+        bus->fd = -1;
+        errno = saved;
+        return -1;
+    }
+    return 0;
+}
+
+int BusWrite ( I2CBus_t * bus, const uint8_t * buf, int len ) {
+    int n;
+
+    if ( bus->fd == -1 ) {
+        errno = EBADF;
+        return -1;
+    }
+    n = bus->simulated ? SimWrite ( &bus->sim, buf, len ) : write ( bus->fd, buf, len );
+    if ( ( n != len ) && ( n >= 0 ) )
+        errno = EIO;
+    return ( n == len ) ? 0 : -1;
+}
+
+int BusRead ( I2CBus_t * bus, uint8_t * buf, int len ) {
+    int n;
+
+    if ( bus->fd == -1 ) {
+        errno = EBADF;
+        return -1;
+    }
+    n = bus->simulated ? SimRead ( &bus->sim, buf, len ) : read ( bus->fd, buf, len );
+    if ( ( n != len ) && ( n >= 0 ) )
+        errno = EIO;
+    return ( n == len ) ? 0 : -1;
+}
+
+void BusClose ( I2CBus_t * bus ) {
+    if ( ( bus->fd != -1 ) && !bus->simulated )
+        close ( bus->fd );
+    bus->fd = -1;
+}
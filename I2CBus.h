@@ -0,0 +1,68 @@
+/*
+ * File:			I2CBus.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		I2C bus access with bounded transfer time, real or simulated
+ *
+ * <MIT License>
+ */
+
+#ifndef I2CBUS_H
+#define I2CBUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "SimDevice.h"
+
+#define DEFAULTBUS "/dev/i2c-2"
+#define SIMBUS "sim"					// Bus name selecting the simulated devices
+#define MAXBUSNAMELENGTH (16)
+
+typedef struct {
+    char path[MAXBUSNAMELENGTH];
+    int address;
+    int timeout;						// Transfer timeout in ms
+    int fd;								// -1 if not open
+    bool simulated;
+    SimDevice_t sim;
+} I2CBus_t;
+
+/**
+ * @brief   Open the bus and select the slave
+ *          The adapter timeout bounds every transfer, the adapter does not retry.
+ *
+ * @param   bus         bus state
+ * @param   path        device path or SIMBUS
+ * @param   address     slave address
+ * @param   timeoutMs   transfer timeout in milliseconds
+ * @param   simModel    device model when simulated
+ * @param   simFail     failure chance in percent when simulated
+ * @param   simWave     simulated NTC: readings per period of a triangle wave, 0 - random values
+ * @return  int         0 on success, -1 with errno set on failure
+ */
+int BusOpen ( I2CBus_t * bus, const char * path, int address, int timeoutMs, int simModel, int simFail, int simWave );
+
+/**
+ * @brief   Write bytes in one transfer
+ *
+ * @return  int     0 on success, -1 with errno set on failure
+ */
+int BusWrite ( I2CBus_t * bus, const uint8_t * buf, int len );
+
+/**
+ * @brief   Read bytes in one transfer
+ *
+ * @return  int     0 on success, -1 with errno set on failure
+ */
+int BusRead ( I2CBus_t * bus, uint8_t * buf, int len );
+
+/**
+ * @brief   Close the bus
+ *
+ * @param   bus     bus state
+ */
+void BusClose ( I2CBus_t * bus );
+
+#endif
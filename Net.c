@@ -0,0 +1,153 @@
+/*
+ * File:			Net.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Network helper functions shared by server, client and collector
+ *
+ * <MIT License>
+ */
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netdb.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Net.h"
+
+int NetParseTarget ( const char * text, char * host, char * port, const char * defaultPort ) {
+    const char * colon;
+    size_t hostLen;
+
+    while ( ( *text == ' ' ) || ( *text == '\t' ) )
+        text++;
+
+    if ( *text == '[' ) {										// [IPv6]:port
+        colon = strchr ( text, ']' );
+        if ( colon == NULL )
+            return -1;
+        hostLen = colon - text - 1;
+        text++;
+        colon = ( colon[1] == ':' ) ? colon + 1 : NULL;
+    } else {
+        colon = strchr ( text, ':' );
+        if ( ( colon != NULL ) && ( strchr ( colon + 1, ':' ) != NULL ) )
+            colon = NULL;										// Bare IPv6 address, no port
+        hostLen = ( colon != NULL ) ? ( size_t ) ( colon - text ) : strcspn ( text, " \t\r\n" );
+    }
+    if ( ( hostLen == 0 ) || ( hostLen >= MAXHOSTLENGTH ) )
+        return -1;
+    memcpy ( host, text, hostLen );
+    host[hostLen] = '\0';
+
+    if ( colon != NULL ) {
+        size_t portLen = strcspn ( colon + 1, " \t\r\n" );
+        if ( ( portLen == 0 ) || ( portLen >= MAXPORTLENGTH ) )
+            return -1;
+        memcpy ( port, colon + 1, portLen );
+        port[portLen] = '\0';
+    } else {
+        strncpy ( port, defaultPort, MAXPORTLENGTH );
+        port[MAXPORTLENGTH - 1] = '\0';
+    }
+    return 0;
+}
+
+void NetStreamPort ( const char * port, char * streamPort ) {
+    snprintf ( streamPort, MAXPORTLENGTH, "%u", ( unsigned short ) ( atoi ( port ) + 1 ) );
+}
+
+int NetSetNonBlocking ( int fd ) {
+    int file_flags = fcntl ( fd, F_GETFL, 0 );
+
+    if ( file_flags == -1 )
+        return -1;
+    return fcntl ( fd, F_SETFL, file_flags | O_NONBLOCK );
+}
+
+int NetListen ( const char * port ) {
+    struct addrinfo hints, *servinfo, *p;
+    int listener = -1;
+    int yes = 1;
+    int rv;
+
+    memset ( &hints, 0, sizeof ( struct addrinfo ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    if ( ( rv = getaddrinfo ( NULL, port, &hints, &servinfo ) ) != 0 ) {
+        printf ( "getaddrinfo: %s\n", gai_strerror ( rv ) );
+        return -1;
+    }
+
+    for ( p = servinfo; p != NULL; p = p->ai_next ) {
+        if ( ( listener = socket ( p->ai_family, p->ai_socktype, p->ai_protocol ) ) == -1 )
+            continue;
+        setsockopt ( listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof ( yes ) );
+        if ( bind ( listener, p->ai_addr, p->ai_addrlen ) == 0 )
+            break;
+        close ( listener );
+        listener = -1;
+    }
+    freeaddrinfo ( servinfo );
+
+    if ( listener == -1 )
+        return -1;
+    if ( ( NetSetNonBlocking ( listener ) == -1 ) || ( listen ( listener, 10 ) == -1 ) ) {
+        close ( listener );
+        return -1;
+    }
+    return listener;
+}
+
+int NetConnectStart ( const char * host, const char * port, int * fd ) {
+    struct addrinfo hints, *servinfo, *p;
+    int result = -1;
+
+    memset ( &hints, 0, sizeof ( struct addrinfo ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if ( getaddrinfo ( host, port, &hints, &servinfo ) != 0 )
+        return -1;
+
+    // Take the first address the connection can be started to
+    for ( p = servinfo; p != NULL; p = p->ai_next ) {
+        if ( ( *fd = socket ( p->ai_family, p->ai_socktype, p->ai_protocol ) ) == -1 )
+            continue;
+        if ( NetSetNonBlocking ( *fd ) == -1 ) {
+            close ( *fd );
+            continue;
+        }
+        if ( connect ( *fd, p->ai_addr, p->ai_addrlen ) == 0 ) {
+            result = 0;
+            break;
+        }
+        if ( errno == EINPROGRESS ) {
+            result = 1;
+            break;
+        }
+        close ( *fd );
+    }
+    freeaddrinfo ( servinfo );
+
+    if ( result == -1 )
+        *fd = -1;
+    return result;
+}
+
+int NetConnectResult ( int fd ) {
+    int err = 0;
+    socklen_t len = sizeof ( err );
+
+    if ( getsockopt ( fd, SOL_SOCKET, SO_ERROR, &err, &len ) == -1 )
+        return errno;
+    return err;
+}
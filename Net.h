@@ -0,0 +1,77 @@
+/*
+ * File:			Net.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Network helper functions shared by server, client and collector
+ *
+ * <MIT License>
+ */
+
+#ifndef NET_H
+#define NET_H
+
+#include <stddef.h>
+
+#define MAXHOSTLENGTH (64)
+#define MAXPORTLENGTH (8)
+
+#define MYPORT "4950"	// the port users will be connecting to
+
+/**
+ * @brief   Split "host[:port]" into host and port
+ *          IPv6 addresses may be written as "[addr]:port".
+ *
+ * @param   text        target description
+ * @param   host        host part
+ * @param   port        port part, defaultPort if not given
+ * @param   defaultPort port used when text has no port
+ * @return  int         0 on success, -1 on malformed input
+ */
+int NetParseTarget ( const char * text, char * host, char * port, const char * defaultPort );
+
+/**
+ * @brief   Port of the sample stream belonging to a command port
+ *          The sample stream listens on the command port + 1.
+ *
+ * @param   port        command port
+ * @param   streamPort  stream port, at least MAXPORTLENGTH bytes
+ */
+void NetStreamPort ( const char * port, char * streamPort );
+
+/**
+ * @brief   Open a non-blocking listening socket on all interfaces
+ *
+ * @param   port    port number as string
+ * @return  int     socket, -1 on error
+ */
+int NetListen ( const char * port );
+
+/**
+ * @brief   Start a non-blocking connection
+ *
+ * @param   host    host name or address
+ * @param   port    port number as string
+ * @param   fd      connecting socket
+ * @return  int     0 connected, 1 in progress, -1 on error
+ */
+int NetConnectStart ( const char * host, const char * port, int * fd );
+
+/**
+ * @brief   Check the result of a connection in progress
+ *          Call when the socket became writable.
+ *
+ * @param   fd      connecting socket
+ * @return  int     0 connected, otherwise errno of the failure
+ */
+int NetConnectResult ( int fd );
+
+/**
+ * @brief   Set socket to non-blocking mode
+ *
+ * @param   fd      socket
+ * @return  int     0 on success, -1 on error
+ */
+int NetSetNonBlocking ( int fd );
+
+#endif
@@ -15,18 +15,70 @@
 #include <ctype.h>
 
 #include "ProcArgs.h"
+#include "Net.h"
+#include "Push.h"
 
 // #ifndef DEBUG
 // #define DEBUG 1
 // #endif
 
-#define MAXLINELENGTH 128
+#define MAXLINELENGTH 256
 
-extern char serverAddress[MAXFILENAMELENGTH];
+extern char serverAddress[MAXTARGETLISTLENGTH];
+extern char serverPort[MAXPORTLENGTH];
+extern char boardListFileName[MAXFILENAMELENGTH];
+extern char storeFileName[MAXFILENAMELENGTH];
+extern int reorderWindow;
+extern char spoolDirName[MAXFILENAMELENGTH];
+extern int spoolBudget;
+extern int catchupRate;
+extern int drainTimeout;
+extern char rulesFileName[MAXFILENAMELENGTH];
+extern char alarmLogFileName[MAXFILENAMELENGTH];
+extern char targetListFileName[MAXFILENAMELENGTH];
+extern int pushParallel;
+extern int pushTimeout;
+extern char traceFileName[MAXFILENAMELENGTH];
 // Constants
 extern const char *defaultMasterLogfileName;
 extern const char *defaultMeasurementLogfileName;
-extern int programMode;					// 0 - Offline, 1 - Client, 2 - Server
+extern const char *defaultStoreFileName;
+extern int programMode;					// 0 - Offline, 1 - Client, 2 - Server, 3 - Collector, 4 - Trace benchmark
+
+/**
+ * @brief Set the optional settings to their defaults
+ *
+ * @param procArg   settings
+ */
+static void SetDefaults ( ProcessArguments_t * procArg ) {
+    memset ( procArg, 0, sizeof ( *procArg ) );
+    strncpy ( procArg->filename, defaultMeasurementLogfileName, MAXFILENAMELENGTH - 1 );
+    procArg->echo = false;
+    procArg->interval = 1;
+    strncpy ( procArg->bus, DEFAULTBUS, MAXBUSNAMELENGTH - 1 );
+    procArg->timeout = DEFAULTTIMEOUT;
+    procArg->retries = DEFAULTRETRIES;
+    procArg->backoff = DEFAULTBACKOFF;
+    procArg->breaker = DEFAULTBREAKER;
+    procArg->cooldown = DEFAULTCOOLDOWN;
+    procArg->simFail = 0;
+    procArg->simWave = 0;
+}
+
+/**
+ * @brief Read a non-negative integer setting
+ *
+ * @param ptok      value token, may be NULL
+ * @param value     setting, unchanged if the token is invalid
+ * @param name      parameter name for the error message
+ */
+static void ReadCount ( const char * ptok, int * value, const char * name ) {
+    if ( ( ptok != NULL ) && isdigit ( ( unsigned char ) ptok[0] ) ) {
+        *value = atoi ( ptok );
+    } else {
+        printf ( "Missing or invalid value! %s parameter is ignored.\n", name );
+    }
+}
 
 /**
  * @brief Process one line of parameters
@@ -121,6 +173,56 @@ static int ProcessLine ( char * textRow, ProcessArguments_t * procArg ) {
                 printf ( "Missing interval value! -interval parameter is ignored.\n" );
             }
         }
+        // Bus and failure handling
+        if ( strcmp ( ptok, "-bus" ) == 0 ) {
+            ptok = strtok ( NULL, " " );
+            if ( ( ptok != NULL ) && ( strlen ( ptok ) < MAXBUSNAMELENGTH ) ) {
+                strncpy ( procArg->bus, ptok, MAXBUSNAMELENGTH );
+            } else {
+                printf ( "Missing or too long bus name! -bus parameter is ignored.\n" );
+            }
+        }
+        if ( strcmp ( ptok, "-timeout" ) == 0 ) {
+            ReadCount ( ptok = strtok ( NULL, " " ), &procArg->timeout, "-timeout" );
+        }
+        if ( strcmp ( ptok, "-retries" ) == 0 ) {
+            ReadCount ( ptok = strtok ( NULL, " " ), &procArg->retries, "-retries" );
+        }
+        if ( strcmp ( ptok, "-backoff" ) == 0 ) {
+            ReadCount ( ptok = strtok ( NULL, " " ), &procArg->backoff, "-backoff" );
+        }
+        if ( strcmp ( ptok, "-breaker" ) == 0 ) {
+            ReadCount ( ptok = strtok ( NULL, " " ), &procArg->breaker, "-breaker" );
+        }
+        if ( strcmp ( ptok, "-cooldown" ) == 0 ) {
+            ReadCount ( ptok = strtok ( NULL, " " ), &procArg->cooldown, "-cooldown" );
+            if ( procArg->cooldown == 0 ) {
+                procArg->cooldown = 1;
+            }
+        }
+        if ( strcmp ( ptok, "-simfail" ) == 0 ) {
+            ReadCount ( ptok = strtok ( NULL, " " ), &procArg->simFail, "-simfail" );
+        }
+        if ( strcmp ( ptok, "-simwave" ) == 0 ) {
+            ReadCount ( ptok = strtok ( NULL, " " ), &procArg->simWave, "-simwave" );
+        }
+        // Snapshot group
+        if ( strcmp ( ptok, "-group" ) == 0 ) {
+            ReadCount ( ptok = strtok ( NULL, " " ), &procArg->group, "-group" );
+        }
+        // Compressed archive
+        if ( strcmp ( ptok, "-archive" ) == 0 ) {
+            ptok = strtok ( NULL, " " );
+            if ( ptok != NULL ) {
+                strncpy ( procArg->archive, ptok, MAXFILENAMELENGTH );
+                procArg->archive[MAXFILENAMELENGTH - 1] = '\0';
+            } else {
+                printf ( "Missing archive filename! -archive parameter is ignored.\n" );
+            }
+        }
+        if ( ptok == NULL ) {
+            break;
+        }
         ptok = strtok ( NULL, " " );
     }   // End of line processing
     return containsSetting;
@@ -141,8 +243,18 @@ static int ProcessLine ( char * textRow, ProcessArguments_t * procArg ) {
  *
  * Command line arguments:
  *      -h
- *      -c -l <master_logfile> -a <address_client_mode> -s -mfile <filename> -sensortype <NTC|SCC30> -sensoraddress <address> -echo {off|on} -interval <t>
+ *      -c -l <master_logfile> -a <address_client_mode> -s -mfile <filename> -sensortype <NTC|SCC> -sensoraddress <address> -echo {off|on} -interval <t>
+ *         [-bus <device|sim>] [-timeout <ms>] [-retries <n>] [-backoff <ms>] [-breaker <n>] [-cooldown <s>] [-simfail <percent>]
+ *         [-simwave <readings>]
+ *         [-group <n>] [-archive <filename>]
  *      -f <inputfile_containing_command> -l <master_logfile> -a <address> -s <address>
+ *      -collect <boardlist> [-store <file>] [-window <ms>] -l <master_logfile>
+ *      -a <host[:port],...> [-targets <file>] [-parallel <n>] [-pushtimeout <ms>] sends the commands to every target
+ *      -p <port> sets the command port for -a, -s and the default for -collect
+ *      -s [-spool <dir> [-spoolsize <MB>] [-catchup <samples/s>]]
+ *      -drain <ms> time the processes get to finish at shutdown
+ *      -rules <file> [-alarmlog <file>] alarm rules evaluated on every sample
+ *      -trace <file> event trace, written on SIGUSR1
  */
 int ReadArgumentsFromCommandLine ( int argc, char *argv[], char * mlfn, ProcessArguments_t * procArgs, int argBufSize ) {
     int processed = 0;
@@ -152,9 +264,10 @@ int ReadArgumentsFromCommandLine ( int argc, char *argv[], char * mlfn, ProcessA
     char settingsFileName[MAXFILENAMELENGTH];
     char textRow[MAXLINELENGTH];
 
-    memset ( serverAddress, 0, MAXFILENAMELENGTH );
+    memset ( serverAddress, 0, MAXTARGETLISTLENGTH );
     memset ( mlfn, 0, MAXFILENAMELENGTH );
     strncpy ( mlfn, defaultMasterLogfileName, strlen ( defaultMasterLogfileName ) );
+    strncpy ( storeFileName, defaultStoreFileName, MAXFILENAMELENGTH );
 
     for ( int i = 1; i < argc; i++ ) {
         if ( strcmp ( argv[i], "-c" ) == 0 )
@@ -177,20 +290,143 @@ int ReadArgumentsFromCommandLine ( int argc, char *argv[], char * mlfn, ProcessA
                 printf ( "Missing log filename! Using default name.\n" );
             }
         }
-        // Client mode
+        // Client mode, repeated -a values are joined into one target list
         if ( strcmp ( argv[i], "-a" ) == 0 ) {
             if ( argc > i + 1 ) {
-                strncpy ( serverAddress, argv[i + 1], MAXFILENAMELENGTH );
-                serverAddress[MAXFILENAMELENGTH - 1] = '\0';
+                size_t used = strlen ( serverAddress );
+
+                if ( used + ( used > 0 ) + strlen ( argv[i + 1] ) >= MAXTARGETLISTLENGTH ) {
+                    printf ( "Target list too long, at most %d characters are allowed.\n", MAXTARGETLISTLENGTH - 1 );
+                    exit ( EXIT_FAILURE );
+                }
+                if ( used > 0 )
+                    serverAddress[used++] = ',';
+                strcpy ( serverAddress + used, argv[i + 1] );
                 programMode = 1;
             } else {
                 printf ( "Missing server address, -s parameter is ignored.\n" );
             }
         }
+        if ( strcmp ( argv[i], "-targets" ) == 0 ) {
+            if ( argc > i + 1 ) {
+                strncpy ( targetListFileName, argv[i + 1], MAXFILENAMELENGTH );
+                targetListFileName[MAXFILENAMELENGTH - 1] = '\0';
+                programMode = 1;
+            } else {
+                printf ( "Missing target list filename, -targets parameter is ignored.\n" );
+            }
+        }
+        if ( strcmp ( argv[i], "-parallel" ) == 0 ) {
+            if ( ( argc > i + 1 ) && ( atoi ( argv[i + 1] ) > 0 ) ) {
+                pushParallel = atoi ( argv[i + 1] );
+            } else {
+                printf ( "Missing or invalid connection limit, -parallel parameter is ignored.\n" );
+            }
+        }
+        if ( strcmp ( argv[i], "-pushtimeout" ) == 0 ) {
+            if ( ( argc > i + 1 ) && ( atoi ( argv[i + 1] ) > 0 ) ) {
+                pushTimeout = atoi ( argv[i + 1] );
+            } else {
+                printf ( "Missing or invalid push timeout, -pushtimeout parameter is ignored.\n" );
+            }
+        }
         // Server mode
         if ( strcmp ( argv[i], "-s" ) == 0 ) {
             programMode = 2;
         }
+        // Command port, the sample stream uses port + 1
+        if ( strcmp ( argv[i], "-p" ) == 0 ) {
+            if ( ( argc > i + 1 ) && ( atoi ( argv[i + 1] ) > 0 ) && ( strlen ( argv[i + 1] ) < MAXPORTLENGTH ) ) {
+                strncpy ( serverPort, argv[i + 1], MAXPORTLENGTH );
+            } else {
+                printf ( "Missing or invalid port number, -p parameter is ignored.\n" );
+            }
+        }
+        // Store-and-forward spool for the sample stream
+        if ( strcmp ( argv[i], "-spool" ) == 0 ) {
+            if ( argc > i + 1 ) {
+                strncpy ( spoolDirName, argv[i + 1], MAXFILENAMELENGTH );
+                spoolDirName[MAXFILENAMELENGTH - 1] = '\0';
+            } else {
+                printf ( "Missing spool directory, -spool parameter is ignored.\n" );
+            }
+        }
+        if ( strcmp ( argv[i], "-spoolsize" ) == 0 ) {
+            if ( ( argc > i + 1 ) && ( atoi ( argv[i + 1] ) > 0 ) ) {
+                spoolBudget = atoi ( argv[i + 1] );
+            } else {
+                printf ( "Missing or invalid spool size, -spoolsize parameter is ignored.\n" );
+            }
+        }
+        if ( strcmp ( argv[i], "-catchup" ) == 0 ) {
+            if ( ( argc > i + 1 ) && ( atoi ( argv[i + 1] ) > 0 ) ) {
+                catchupRate = atoi ( argv[i + 1] );
+            } else {
+                printf ( "Missing or invalid catch-up rate, -catchup parameter is ignored.\n" );
+            }
+        }
+        // Shutdown deadline
+        if ( strcmp ( argv[i], "-drain" ) == 0 ) {
+            if ( ( argc > i + 1 ) && ( atoi ( argv[i + 1] ) >= 0 ) ) {
+                drainTimeout = atoi ( argv[i + 1] );
+            } else {
+                printf ( "Missing or invalid drain time, -drain parameter is ignored.\n" );
+            }
+        }
+        // Alarm rules
+        if ( strcmp ( argv[i], "-rules" ) == 0 ) {
+            if ( argc > i + 1 ) {
+                strncpy ( rulesFileName, argv[i + 1], MAXFILENAMELENGTH );
+                rulesFileName[MAXFILENAMELENGTH - 1] = '\0';
+            } else {
+                printf ( "Missing rules filename, -rules parameter is ignored.\n" );
+            }
+        }
+        if ( strcmp ( argv[i], "-alarmlog" ) == 0 ) {
+            if ( argc > i + 1 ) {
+                strncpy ( alarmLogFileName, argv[i + 1], MAXFILENAMELENGTH );
+                alarmLogFileName[MAXFILENAMELENGTH - 1] = '\0';
+            } else {
+                printf ( "Missing alarm log filename, -alarmlog parameter is ignored.\n" );
+            }
+        }
+        // Event trace
+        if ( strcmp ( argv[i], "-trace" ) == 0 ) {
+            if ( argc > i + 1 ) {
+                strncpy ( traceFileName, argv[i + 1], MAXFILENAMELENGTH );
+                traceFileName[MAXFILENAMELENGTH - 1] = '\0';
+            } else {
+                printf ( "Missing trace filename, -trace parameter is ignored.\n" );
+            }
+        }
+        if ( strcmp ( argv[i], "-tracebench" ) == 0 ) {
+            programMode = 4;
+        }
+        // Collector mode
+        if ( strcmp ( argv[i], "-collect" ) == 0 ) {
+            if ( argc > i + 1 ) {
+                strncpy ( boardListFileName, argv[i + 1], MAXFILENAMELENGTH );
+                boardListFileName[MAXFILENAMELENGTH - 1] = '\0';
+                programMode = 3;
+            } else {
+                printf ( "Missing board list filename, -collect parameter is ignored.\n" );
+            }
+        }
+        if ( strcmp ( argv[i], "-store" ) == 0 ) {
+            if ( argc > i + 1 ) {
+                strncpy ( storeFileName, argv[i + 1], MAXFILENAMELENGTH );
+                storeFileName[MAXFILENAMELENGTH - 1] = '\0';
+            } else {
+                printf ( "Missing store filename! Using default name.\n" );
+            }
+        }
+        if ( strcmp ( argv[i], "-window" ) == 0 ) {
+            if ( ( argc > i + 1 ) && ( atoi ( argv[i + 1] ) >= 0 ) ) {
+                reorderWindow = atoi ( argv[i + 1] );
+            } else {
+                printf ( "Missing or invalid reorder window, -window parameter is ignored.\n" );
+            }
+        }
     }
 
     if ( commandInput ) {
@@ -198,6 +434,10 @@ int ReadArgumentsFromCommandLine ( int argc, char *argv[], char * mlfn, ProcessA
 
         // Convert command line arguments to textRow readable string format
         for ( int i = 1; i < argc; i++ ) {
+            if ( strlen ( textRow ) + strlen ( argv[i] ) + 2 > MAXLINELENGTH ) {
+                printf ( "Command line too long, arguments from %s are ignored.\n", argv[i] );
+                break;
+            }
             strcat ( textRow, argv[i] );
             strcat ( textRow, " " );
         }
@@ -206,6 +446,7 @@ int ReadArgumentsFromCommandLine ( int argc, char *argv[], char * mlfn, ProcessA
         printf ( "Concat. arguments : %s\n", textRow );
 #endif
 
+        SetDefaults ( &procArgs[processed] );
         if ( ProcessLine ( textRow, &procArgs[processed] ) == 2 ) {         // There are 2 required parameters
             processed++;                                                    // If valid setting found then keep the record
         }
@@ -218,6 +459,8 @@ int ReadArgumentsFromCommandLine ( int argc, char *argv[], char * mlfn, ProcessA
                     && ( processed < argBufSize ) ) {	// Read 1 row from file
                 if ( textRow[0] == '#' )                                    // Skip comment lines
                     continue;
+                textRow[strcspn ( textRow, "\r\n" )] = '\0';
+                SetDefaults ( &procArgs[processed] );
                 if ( ProcessLine ( textRow, &procArgs[processed] ) == 2 ) { // There are 2 required parameters
                     processed++;                                            // If valid setting found then keep the record
                 }
@@ -228,6 +471,7 @@ int ReadArgumentsFromCommandLine ( int argc, char *argv[], char * mlfn, ProcessA
 #ifdef DEBUG
     printf ( "Master log filename: %s\n", mlfn );
     printf ( "Socket address: %s\n", serverAddress );
+    printf ( "Port: %s\n", serverPort );
     printf ( "Found %d process setting.\n", processed );
     for ( int i = 0; i < processed; i++ ) {
         printf ( "Sensor type: %s, sensor address: %d, filename: %s, echo: %d, interval: %d\n",
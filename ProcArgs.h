@@ -11,14 +11,35 @@
 #ifndef PROCARGS_H
 #define PROCARGS_H
 
+#include <stdbool.h>
+
+#include "I2CBus.h"
+
 #define MAXFILENAMELENGTH (32)
 
+// Defaults of the optional per-sensor settings
+#define DEFAULTTIMEOUT (50)				// ms
+#define DEFAULTRETRIES (2)
+#define DEFAULTBACKOFF (10)				// ms
+#define DEFAULTBREAKER (3)
+#define DEFAULTCOOLDOWN (5)				// s
+
 typedef struct {
 	char sensorType[4];					// Sensor type: SensorModule NTC, SCC30-DB (Set at start)
 	int sensorAddress;					// Sensor address (Set at start)
 	char filename[MAXFILENAMELENGTH];	// Filename for measurement logging (Set at start)
 	bool echo;							// Echoing to stdout on/off
 	int interval;						// Time interval of reading (Can be set any time)
+	char bus[MAXBUSNAMELENGTH];			// I2C bus device, "sim" for simulated sensors
+	int timeout;						// Bus transfer timeout in ms
+	int retries;						// Retries of a failed reading
+	int backoff;						// Delay before the first retry in ms, doubled for each retry
+	int breaker;						// Consecutive failed readings suspending the sensor, 0 - never
+	int cooldown;						// Seconds a suspended sensor is left alone before probing
+	int simFail;						// Failure chance of simulated transfers in percent
+	int simWave;						// Simulated NTC: readings per period of a triangle wave, 0 - random values
+	int group;							// Snapshot group, sensors of a group are read together, 0 - none
+	char archive[MAXFILENAMELENGTH];	// Compressed archive for the values, empty - values go to the measurement log
 } ProcessArguments_t;
 
 /**
@@ -36,8 +57,17 @@ typedef struct {
  *
  * Command line arguments:
  *      -h
- *      -c -l <master_logfile> -a <address_client_mode> -s -mfile <filename> -sensortype <NTC|SCC30> -sensoraddress <address> -echo {off|on} -interval <t>
+ *      -c -l <master_logfile> -a <address_client_mode> -s -mfile <filename> -sensortype <NTC|SCC> -sensoraddress <address> -echo {off|on} -interval <t>
+ *         [-bus <device|sim>] [-timeout <ms>] [-retries <n>] [-backoff <ms>] [-breaker <n>] [-cooldown <s>] [-simfail <percent>]
+ *         [-group <n>] [-archive <filename>]
  *      -f <inputfile_containing_command> -l <master_logfile> -a <address> -s <address>
+ *      -collect <boardlist> [-store <file>] [-window <ms>] -l <master_logfile>
+ *      -a <host[:port],...> [-targets <file>] [-parallel <n>] [-pushtimeout <ms>] sends the commands to every target
+ *      -p <port> sets the command port for -a, -s and the default for -collect
+ *      -s [-spool <dir> [-spoolsize <MB>] [-catchup <samples/s>]]
+ *      -drain <ms> time the processes get to finish at shutdown
+ *      -rules <file> [-alarmlog <file>] alarm rules evaluated on every sample
+ *      -trace <file> event trace, written on SIGUSR1
  */
 int ReadArgumentsFromCommandLine (int argc, char *argv[], char * mlfn, ProcessArguments_t * procArgs, int argBufSize );
 
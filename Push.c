@@ -0,0 +1,315 @@
+/*
+ * File:			Push.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Client mode, sends the commands to many SensorMaster servers at once
+ *
+ * Every target goes through connecting, sending and closing on a non-blocking
+ * socket, one poll() serves all of them. A target is only done when the server
+ * closed the connection after our end of data, so it has read the commands. A slow or dead server only costs its own
+ * timeout, the run takes about (targets / parallel) * slowest target.
+ *
+ * <MIT License>
+ */
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Net.h"
+#include "Push.h"
+
+#define TARGET_WAITING (0)
+#define TARGET_CONNECTING (1)
+#define TARGET_SENDING (2)
+#define TARGET_CLOSING (3)				// All sent, waiting for the server to close
+#define TARGET_DONE (4)
+#define TARGET_FAILED (5)
+
+#define MAXLINELENGTH 128
+
+extern char serverPort[MAXPORTLENGTH];
+extern void getTimeStr ( char * timeStr, size_t len );
+
+typedef struct {
+    char host[MAXHOSTLENGTH];
+    char port[MAXPORTLENGTH];
+    char name[MAXHOSTLENGTH + MAXPORTLENGTH];
+    int fd;
+    int state;
+    size_t sent;						// Bytes of the commands already sent
+    int64_t start;						// ns, connection started
+    int64_t latency;					// ns, start to the server closing or to failure
+    char error[48];						// TARGET_FAILED: reason
+} Target_t;
+
+static Target_t targets[MAXPUSHTARGETS];
+static int targetCount;
+
+static int64_t MonotonicNs ( void ) {
+    struct timespec now;
+
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return ( int64_t ) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static int AddTarget ( const char * text ) {
+    Target_t * target;
+    char host[MAXHOSTLENGTH];
+    char port[MAXPORTLENGTH];
+
+    if ( targetCount == MAXPUSHTARGETS ) {
+        printf ( "Too many targets, at most %d are allowed.\n", MAXPUSHTARGETS );
+        return -1;
+    }
+    target = &targets[targetCount];
+    if ( NetParseTarget ( text, host, port, serverPort ) == -1 ) {
+        printf ( "Invalid target address: %s\n", text );
+        return -1;
+    }
+    // The name is built from the local copies, not from fields of the same target
+    memcpy ( target->host, host, sizeof ( target->host ) );
+    memcpy ( target->port, port, sizeof ( target->port ) );
+    snprintf ( target->name, sizeof ( target->name ), "%s:%s", host, port );
+    target->fd = -1;
+    target->state = TARGET_WAITING;
+    targetCount++;
+    return 0;
+}
+
+/**
+ * @brief Collect the targets, -1 if any of them is invalid or they do not fit
+ */
+static int ReadTargets ( const char * address, const char * targetListFile ) {
+    static char list[MAXTARGETLISTLENGTH];
+    FILE * listFile;
+    char textRow[MAXLINELENGTH];
+    char * ptok;
+    char * rest;
+    int rv = 0;
+
+    targetCount = 0;
+    if ( snprintf ( list, sizeof ( list ), "%s", address ) >= ( int ) sizeof ( list ) ) {
+        printf ( "Target list too long, at most %d characters are allowed.\n", MAXTARGETLISTLENGTH - 1 );
+        return -1;
+    }
+    for ( ptok = strtok_r ( list, ",", &rest ); ptok != NULL; ptok = strtok_r ( NULL, ",", &rest ) ) {
+        if ( AddTarget ( ptok ) == -1 )
+            return -1;
+    }
+
+    if ( targetListFile[0] == '\0' )
+        return targetCount;
+    listFile = fopen ( targetListFile, "r" );
+    if ( listFile == NULL ) {
+        perror ( "targetlist" );
+        return -1;
+    }
+    while ( ( rv == 0 ) && ( fgets ( textRow, MAXLINELENGTH, listFile ) != NULL ) ) {
+        if ( ( strchr ( textRow, '\n' ) == NULL ) && !feof ( listFile ) ) {
+            printf ( "Line too long in %s: %s...\n", targetListFile, textRow );
+            rv = -1;
+            break;
+        }
+        textRow[strcspn ( textRow, "\r\n" )] = '\0';
+        if ( ( textRow[0] == '#' ) || ( strspn ( textRow, " \t" ) == strlen ( textRow ) ) )
+            continue;
+        rv = AddTarget ( textRow );
+    }
+    fclose ( listFile );
+    return ( rv == 0 ) ? targetCount : -1;
+}
+
+static void TargetFinish ( Target_t * target, int state, const char * error ) {
+    if ( target->fd != -1 )
+        close ( target->fd );
+    target->fd = -1;
+    target->state = state;
+    if ( error != NULL )
+        snprintf ( target->error, sizeof ( target->error ), "%s", error );
+    target->latency = MonotonicNs () - target->start;
+}
+
+/**
+ * @brief Send the rest of the commands, then close our side of the connection
+ */
+static void TargetSend ( Target_t * target, const char * data, size_t length ) {
+    ssize_t n;
+
+    while ( target->sent < length ) {
+        n = send ( target->fd, data + target->sent, length - target->sent, MSG_DONTWAIT | MSG_NOSIGNAL );
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            if ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) )
+                TargetFinish ( target, TARGET_FAILED, strerror ( errno ) );
+            return;
+        }
+        target->sent += n;
+    }
+    // The server reads the commands until our end of data, then closes
+    if ( shutdown ( target->fd, SHUT_WR ) == -1 ) {
+        TargetFinish ( target, TARGET_FAILED, strerror ( errno ) );
+        return;
+    }
+    target->state = TARGET_CLOSING;
+}
+
+/**
+ * @brief Wait for the end of data from the server, the target is done when it comes
+ */
+static void TargetClose ( Target_t * target ) {
+    char discard[64];
+    ssize_t n;
+
+    for ( ;; ) {
+        n = recv ( target->fd, discard, sizeof ( discard ), MSG_DONTWAIT );
+        if ( n == 0 ) {
+            TargetFinish ( target, TARGET_DONE, NULL );
+            return;
+        }
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            if ( ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) )
+                TargetFinish ( target, TARGET_FAILED, strerror ( errno ) );
+            return;
+        }
+    }
+}
+
+int PushCommands ( const char * address, const char * targetListFile, const ProcessArguments_t * procArgs, int count,
+                   int parallel, int timeoutMs, FILE * masterLogfile ) {
+    static struct pollfd pfds[MAXPUSHTARGETS];
+    static int pfdTarget[MAXPUSHTARGETS];
+    const char * data = ( const char * ) procArgs;
+    size_t length = count * sizeof ( ProcessArguments_t );
+    int64_t timeout = ( int64_t ) timeoutMs * 1000000LL;
+    int64_t runStart, now, wait;
+    char timestamp[40];
+    int next = 0;
+    int active = 0;
+    int finished = 0;
+    int failed = 0;
+    int nfds;
+
+    switch ( ReadTargets ( address, targetListFile ) ) {
+    case -1:
+        printf ( "Target list rejected, no commands were sent.\n" );
+        return EXIT_FAILURE;
+    case 0:
+        printf ( "No targets to send the commands to.\n" );
+        return EXIT_FAILURE;
+    }
+    if ( parallel < 1 )
+        parallel = 1;
+
+    runStart = MonotonicNs ();
+    while ( finished < targetCount ) {
+        // Start connections up to the limit
+        while ( ( active < parallel ) && ( next < targetCount ) ) {
+            Target_t * target = &targets[next++];
+
+            target->start = MonotonicNs ();
+            target->sent = 0;
+            switch ( NetConnectStart ( target->host, target->port, &target->fd ) ) {
+            case 0:
+                target->state = TARGET_SENDING;
+                TargetSend ( target, data, length );
+                break;
+            case 1:
+                target->state = TARGET_CONNECTING;
+                break;
+            default:
+                TargetFinish ( target, TARGET_FAILED, "address not resolved or no socket" );
+                break;
+            }
+            if ( ( target->state == TARGET_DONE ) || ( target->state == TARGET_FAILED ) )
+                finished++;
+            else
+                active++;
+        }
+
+        // Wait for the sockets in progress, until the earliest deadline
+        now = MonotonicNs ();
+        wait = timeout;
+        nfds = 0;
+        for ( int t = 0; t < next; t++ ) {
+            if ( ( targets[t].state != TARGET_CONNECTING ) && ( targets[t].state != TARGET_SENDING )
+                    && ( targets[t].state != TARGET_CLOSING ) )
+                continue;
+            if ( targets[t].start + timeout - now < wait )
+                wait = targets[t].start + timeout - now;
+            pfds[nfds].fd = targets[t].fd;
+            pfds[nfds].events = ( targets[t].state == TARGET_CLOSING ) ? POLLIN : POLLOUT;
+            pfdTarget[nfds] = t;
+            nfds++;
+        }
+        if ( nfds == 0 )
+            continue;
+        poll ( pfds, nfds, ( wait > 0 ) ? ( int ) ( ( wait + 999999 ) / 1000000 ) : 0 );
+
+        now = MonotonicNs ();
+        for ( int i = 0; i < nfds; i++ ) {
+            Target_t * target = &targets[pfdTarget[i]];
+            int err;
+
+            if ( pfds[i].revents != 0 ) {
+                if ( target->state == TARGET_CONNECTING ) {
+                    err = NetConnectResult ( target->fd );
+                    if ( err != 0 ) {
+                        TargetFinish ( target, TARGET_FAILED, strerror ( err ) );
+                    } else {
+                        target->state = TARGET_SENDING;
+                    }
+                }
+                if ( target->state == TARGET_SENDING ) {
+                    TargetSend ( target, data, length );
+                } else if ( target->state == TARGET_CLOSING ) {
+                    TargetClose ( target );
+                }
+            }
+            if ( ( ( target->state == TARGET_CONNECTING ) || ( target->state == TARGET_SENDING ) || ( target->state == TARGET_CLOSING ) )
+                    && ( now - target->start >= timeout ) ) {
+                TargetFinish ( target, TARGET_FAILED, ( target->state == TARGET_CONNECTING ) ? "connect timed out"
+                               : ( target->state == TARGET_SENDING ) ? "send timed out" : "server did not close" );
+            }
+            if ( ( target->state == TARGET_DONE ) || ( target->state == TARGET_FAILED ) ) {
+                finished++;
+                active--;
+            }
+        }
+    }
+
+    // Report
+    getTimeStr ( timestamp, sizeof ( timestamp ) );
+    for ( int t = 0; t < targetCount; t++ ) {
+        Target_t * target = &targets[t];
+
+        if ( target->state == TARGET_DONE ) {
+            printf ( "%-28s ok      %8.2f ms\n", target->name, target->latency / 1e6 );
+            fprintf ( masterLogfile, "%s, %s, Command send successful, %.2f ms\n", timestamp, target->name, target->latency / 1e6 );
+        } else {
+            failed++;
+            printf ( "%-28s FAILED  %8.2f ms  %s\n", target->name, target->latency / 1e6, target->error );
+            fprintf ( masterLogfile, "%s, %s, Command send failed, %.2f ms, %s\n", timestamp, target->name,
+                      target->latency / 1e6, target->error );
+        }
+    }
+    now = MonotonicNs ();
+    printf ( "Commands sent to %d/%d targets in %.2f ms, parallel: %d\n", targetCount - failed, targetCount,
+             ( now - runStart ) / 1e6, parallel );
+    fprintf ( masterLogfile, "%s Commands sent to %d/%d targets in %.2f ms, parallel: %d\n", timestamp,
+              targetCount - failed, targetCount, ( now - runStart ) / 1e6, parallel );
+    return ( failed == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
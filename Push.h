@@ -0,0 +1,47 @@
+/*
+ * File:			Push.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Client mode, sends the commands to many SensorMaster servers at once
+ *
+ * <MIT License>
+ */
+
+#ifndef PUSH_H
+#define PUSH_H
+
+#include <stdio.h>
+
+#include "ProcArgs.h"
+#include "Net.h"
+
+#define MAXPUSHTARGETS (512)			// Servers per run
+#define MAXTARGETLISTLENGTH (MAXPUSHTARGETS * ( MAXHOSTLENGTH + MAXPORTLENGTH ))	// -a list, "host:port," per target
+#define DEFAULTPUSHPARALLEL (16)		// Connections in progress at once
+#define DEFAULTPUSHTIMEOUT (3000)		// ms per server, connect, send and close
+
+/**
+ * @brief   Send the commands to every target
+ *          Targets are the comma separated "host[:port]" list of address and
+ *          the lines of targetListFile (same format as the collector's board
+ *          list); either may be empty. An invalid target or more than
+ *          MAXPUSHTARGETS targets reject the whole run, nothing is sent.
+ *          Connections are non-blocking, at most
+ *          parallel are in progress at once and each has timeoutMs to connect,
+ *          send and see the server close the connection after reading. A line per target with the result and latency is printed
+ *          and logged.
+ *
+ * @param   address         target list, may be empty
+ * @param   targetListFile  file containing targets, may be empty
+ * @param   procArgs        commands
+ * @param   count           number of commands
+ * @param   parallel        connection limit
+ * @param   timeoutMs       time limit per target
+ * @param   masterLogfile   log for the results
+ * @return  int             EXIT_SUCCESS if every target got the commands, otherwise EXIT_FAILURE
+ */
+int PushCommands ( const char * address, const char * targetListFile, const ProcessArguments_t * procArgs, int count,
+                   int parallel, int timeoutMs, FILE * masterLogfile );
+
+#endif
@@ -0,0 +1,260 @@
+/*
+ * File:			Rules.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Alarm rules evaluated on every sample
+ *
+ * The rules file is compiled once into a flat table; names, targets and
+ * commands are kept apart from the part the evaluation reads. A sample is
+ * scaled to thousandths once, then every rule of its sensor costs a few
+ * integer compares.
+ *
+ * <MIT License>
+ */
+
+#include <sys/types.h>
+#include <netdb.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "Rules.h"
+#include "Net.h"
+
+#define MAXLINELENGTH (256)
+
+// Sample value to thousandths, by decimals
+static const int64_t scaleUp[] = { 1000, 100, 10, 1 };
+static const int64_t scaleDown[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+/**
+ * @brief Parse a decimal number to thousandths, "21.5" is 21500
+ *
+ * @return int 0 on success, -1 if it is not a number
+ */
+static int ParseMilli ( const char * text, int64_t * value ) {
+    char * end;
+    double v;
+
+    if ( text == NULL )
+        return -1;
+    v = strtod ( text, &end );
+    if ( ( end == text ) || ( *end != '\0' ) )
+        return -1;
+    *value = ( int64_t ) ( v * 1000.0 + ( ( v < 0 ) ? -0.5 : 0.5 ) );
+    return 0;
+}
+
+static int ResolveTarget ( RuleAction_t * action, const char * text ) {
+    char host[MAXHOSTLENGTH];
+    char port[MAXPORTLENGTH];
+    struct addrinfo hints, *result;
+
+    if ( ( text == NULL ) || ( NetParseTarget ( text, host, port, "" ) == -1 ) || ( port[0] == '\0' ) )
+        return -1;
+    memset ( &hints, 0, sizeof ( hints ) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if ( getaddrinfo ( host, port, &hints, &result ) != 0 )
+        return -1;
+    memcpy ( &action->target, result->ai_addr, result->ai_addrlen );
+    action->targetLength = result->ai_addrlen;
+    freeaddrinfo ( result );
+    return 0;
+}
+
+/**
+ * @brief Compile one line of the rules file
+ *
+ * @return int 0 on success, -1 with the reason in error
+ */
+static int CompileRule ( char * line, Rule_t * rule, RuleAction_t * action, const char ** error ) {
+    char * ptok;
+    char * rest;
+    unsigned int address;
+    int channel = -1;
+
+    memset ( rule, 0, sizeof ( *rule ) );
+    memset ( action, 0, sizeof ( *action ) );
+    rule->n = 1;
+    rule->m = 1;
+
+    // Name and sensor
+    ptok = strtok_r ( line, " \t", &rest );
+    if ( ( ptok == NULL ) || ( strlen ( ptok ) >= MAXRULENAMELENGTH ) ) {
+        *error = "missing or too long name";
+        return -1;
+    }
+    strcpy ( action->name, ptok );
+    ptok = strtok_r ( NULL, " \t", &rest );
+    if ( ( ptok == NULL ) || ( sscanf ( ptok, "%x:%d", &address, &channel ) < 1 ) || ( address > 0xFFFF ) ) {
+        *error = "missing or invalid sensor address";
+        return -1;
+    }
+    rule->address = ( uint16_t ) address;
+    rule->channel = ( int16_t ) channel;
+
+    // Condition
+    ptok = strtok_r ( NULL, " \t", &rest );
+    if ( ptok == NULL ) {
+        *error = "missing condition";
+        return -1;
+    } else if ( strcmp ( ptok, "above" ) == 0 ) {
+        rule->type = RULE_ABOVE;
+    } else if ( strcmp ( ptok, "below" ) == 0 ) {
+        rule->type = RULE_BELOW;
+    } else if ( strcmp ( ptok, "rate" ) == 0 ) {
+        rule->type = RULE_RATE;
+    } else {
+        *error = "unknown condition";
+        return -1;
+    }
+    if ( ParseMilli ( strtok_r ( NULL, " \t", &rest ), &rule->threshold ) == -1 ) {
+        *error = "missing or invalid threshold";
+        return -1;
+    }
+    if ( ( rule->type == RULE_RATE ) && ( rule->threshold <= 0 ) ) {
+        *error = "rate must be positive";
+        return -1;
+    }
+    rule->clear = rule->threshold;
+
+    // Options, then the action
+    ptok = strtok_r ( NULL, " \t", &rest );
+    while ( ptok != NULL ) {
+        if ( strcmp ( ptok, "clear" ) == 0 ) {
+            if ( ( rule->type == RULE_RATE ) || ( ParseMilli ( strtok_r ( NULL, " \t", &rest ), &rule->clear ) == -1 )
+                    || ( ( rule->type == RULE_ABOVE ) && ( rule->clear > rule->threshold ) )
+                    || ( ( rule->type == RULE_BELOW ) && ( rule->clear < rule->threshold ) ) ) {
+                *error = "invalid clear level, it must be on the normal side of the threshold";
+                return -1;
+            }
+        } else if ( strcmp ( ptok, "count" ) == 0 ) {
+            int n, m;
+
+            ptok = strtok_r ( NULL, " \t", &rest );
+            if ( ( ptok == NULL ) || ( sscanf ( ptok, "%d/%d", &n, &m ) != 2 ) || ( n < 1 ) || ( n > m ) || ( m > MAXRULEWINDOW ) ) {
+                *error = "invalid count, n/m with 1 <= n <= m <= 32";
+                return -1;
+            }
+            rule->n = ( uint8_t ) n;
+            rule->m = ( uint8_t ) m;
+        } else if ( strcmp ( ptok, "log" ) == 0 ) {
+            action->action = ACTION_LOG;
+            return 0;
+        } else if ( strcmp ( ptok, "notify" ) == 0 ) {
+            action->action = ACTION_NOTIFY;
+            if ( ResolveTarget ( action, strtok_r ( NULL, " \t", &rest ) ) == -1 ) {
+                *error = "invalid or unknown notify target, host:port";
+                return -1;
+            }
+            return 0;
+        } else if ( strcmp ( ptok, "exec" ) == 0 ) {
+            action->action = ACTION_EXEC;
+            while ( isspace ( ( unsigned char ) *rest ) )
+                rest++;
+            if ( ( *rest == '\0' ) || ( strlen ( rest ) >= MAXRULECOMMANDLENGTH ) ) {
+                *error = "missing or too long command";
+                return -1;
+            }
+            strcpy ( action->command, rest );
+            return 0;
+        } else {
+            *error = "unknown option or action";
+            return -1;
+        }
+        ptok = strtok_r ( NULL, " \t", &rest );
+    }
+    *error = "missing action";
+    return -1;
+}
+
+int RulesLoad ( RuleTable_t * table, const char * fileName ) {
+    FILE * rulesFile;
+    char line[MAXLINELENGTH];
+    const char * error = NULL;
+    char * p;
+    int lineNumber = 0;
+
+    table->count = 0;
+    rulesFile = fopen ( fileName, "r" );
+    if ( rulesFile == NULL ) {
+        perror ( fileName );
+        return -1;
+    }
+    while ( fgets ( line, sizeof ( line ), rulesFile ) != NULL ) {
+        lineNumber++;
+        line[strcspn ( line, "#\r\n" )] = '\0';
+        for ( p = line; isspace ( ( unsigned char ) *p ); p++ )
+            ;
+        if ( *p == '\0' )
+            continue;
+        if ( table->count == MAXRULES ) {
+            error = "too many rules";
+        } else if ( CompileRule ( p, &table->rules[table->count], &table->actions[table->count], &error ) == 0 ) {
+            table->count++;
+            continue;
+        }
+        printf ( "%s:%d: %s\n", fileName, lineNumber, error );
+        fclose ( rulesFile );
+        return -1;
+    }
+    fclose ( rulesFile );
+    return table->count;
+}
+
+int RulesEvaluate ( RuleTable_t * table, const Sample_t * s, AlarmEvent_t * events, int maxEvents ) {
+    int64_t value;
+    int64_t dt, change;
+    bool hit;
+    int count = 0;
+
+    value = ( s->decimals <= 3 ) ? s->value * scaleUp[s->decimals]
+            : s->value / scaleDown[( s->decimals < 9 ) ? s->decimals - 3 : 6];
+
+    for ( int i = 0; i < table->count; i++ ) {
+        Rule_t * rule = &table->rules[i];
+
+        if ( ( rule->address != s->sensorAddress ) || ( ( rule->channel >= 0 ) && ( rule->channel != s->channel ) ) )
+            continue;
+
+        switch ( rule->type ) {
+        case RULE_ABOVE:
+            hit = value > ( rule->active ? rule->clear : rule->threshold );
+            break;
+        case RULE_BELOW:
+            hit = value < ( rule->active ? rule->clear : rule->threshold );
+            break;
+        default:												// RULE_RATE, change per s against the previous sample
+            dt = ( s->timestamp - rule->lastTime ) / 1000000;		// ms
+            change = ( value > rule->lastValue ) ? value - rule->lastValue : rule->lastValue - value;
+            hit = ( rule->lastTime != 0 ) && ( dt > 0 ) && ( change * 1000 > rule->threshold * dt );
+            rule->lastValue = value;
+            rule->lastTime = s->timestamp;
+            break;
+        }
+
+        // N of the last M samples
+        rule->history = ( rule->history << 1 ) | ( hit ? 1 : 0 );
+        if ( rule->m < 32 )
+            rule->history &= ( 1u << rule->m ) - 1;
+        hit = __builtin_popcount ( rule->history ) >= rule->n;
+
+        if ( ( hit != rule->active ) && ( count < maxEvents ) ) {
+            rule->active = hit;
+            events[count].sampleTime = s->timestamp;
+            events[count].value = s->value;
+            events[count].rule = ( uint16_t ) i;
+            events[count].address = s->sensorAddress;
+            events[count].channel = s->channel;
+            events[count].decimals = s->decimals;
+            events[count].unit = s->unit;
+            events[count].raised = hit;
+            count++;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,105 @@
+/*
+ * File:			Rules.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Alarm rules evaluated on every sample
+ *
+ * <MIT License>
+ */
+
+#ifndef RULES_H
+#define RULES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+
+#include "Sample.h"
+
+#define MAXRULES (64)
+#define MAXRULENAMELENGTH (16)
+#define MAXRULECOMMANDLENGTH (128)
+#define MAXRULEWINDOW (32)				// M of an N-of-M condition
+
+#define RULE_ABOVE (0)					// Value above threshold, active until below clear level
+#define RULE_BELOW (1)					// Value below threshold, active until above clear level
+#define RULE_RATE (2)					// Change faster than threshold per second, either direction
+
+#define ACTION_LOG (0)					// Alarm log only
+#define ACTION_NOTIFY (1)				// UDP datagram to a host
+#define ACTION_EXEC (2)					// Run a shell command
+
+/*
+ * Hot part of a rule, what the evaluation touches. Thresholds and values
+ * are compared in thousandths of the unit, so the evaluation is integer only.
+ */
+typedef struct {
+    uint16_t address;
+    int16_t channel;					// -1 any channel
+    uint8_t type;						// RULE_ABOVE, RULE_BELOW or RULE_RATE
+    uint8_t n;							// Hits needed ...
+    uint8_t m;							// ... of the last m samples
+    bool active;						// Alarm raised
+    uint32_t history;					// Hits of the last samples, newest in bit 0
+    int64_t threshold;					// Thousandths, per second for RULE_RATE
+    int64_t clear;						// Hysteresis: level where an active alarm clears
+    int64_t lastValue;					// RULE_RATE: previous sample
+    int64_t lastTime;					// ns, 0 if no previous sample
+} Rule_t;
+
+/*
+ * Cold part, only used when an alarm is dispatched
+ */
+typedef struct {
+    char name[MAXRULENAMELENGTH];
+    int action;							// ACTION_LOG, ACTION_NOTIFY or ACTION_EXEC
+    struct sockaddr_storage target;		// ACTION_NOTIFY, resolved at load
+    socklen_t targetLength;
+    char command[MAXRULECOMMANDLENGTH];	// ACTION_EXEC
+} RuleAction_t;
+
+typedef struct {
+    int count;
+    Rule_t rules[MAXRULES];
+    RuleAction_t actions[MAXRULES];
+} RuleTable_t;
+
+typedef struct {
+    int64_t sampleTime;					// Sample timestamp, ns CLOCK_REALTIME
+    int64_t evalTime;					// Alarm detected, ns CLOCK_REALTIME
+    int32_t value;
+    uint16_t rule;						// Index in the rule table
+    uint16_t address;
+    uint8_t channel;
+    uint8_t decimals;
+    char unit;
+    bool raised;						// true - raised, false - cleared
+} AlarmEvent_t;
+
+/**
+ * @brief   Read and compile a rules file
+ *          One rule per line, '#' starts a comment:
+ *          <name> <address>[:<channel>] above|below <value> [clear <value>] [count <n>/<m>] <action>
+ *          <name> <address>[:<channel>] rate <value per s> [count <n>/<m>] <action>
+ *          action: log | notify <host>:<port> | exec <command>
+ *
+ * @param   table       compiled rules
+ * @param   fileName    rules file
+ * @return  int         number of rules, -1 on error (reported on stdout)
+ */
+int RulesLoad ( RuleTable_t * table, const char * fileName );
+
+/**
+ * @brief   Evaluate the rules of the sample's sensor
+ *          Reports only changes: an alarm raised or cleared.
+ *
+ * @param   table       compiled rules, state is updated
+ * @param   s           sample
+ * @param   events      raised and cleared alarms
+ * @param   maxEvents   size of events
+ * @return  int         number of events
+ */
+int RulesEvaluate ( RuleTable_t * table, const Sample_t * s, AlarmEvent_t * events, int maxEvents );
+
+#endif
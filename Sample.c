@@ -0,0 +1,85 @@
+/*
+ * File:			Sample.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Measurement sample record and its network wire format
+ *
+ * <MIT License>
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <endian.h>
+#include <time.h>
+
+#include "Sample.h"
+
+/*
+ * Wire layout, all fields big endian:
+ *   0  int64  timestamp
+ *   8  uint32 seq
+ *  12  int32  value
+ *  16  uint16 sensorAddress
+ *  18  uint8  channel
+ *  19  uint8  decimals
+ *  20  char   unit
+ *  21  3 bytes reserved (zero)
+ */
+
+void SampleEncode ( const Sample_t * s, unsigned char * buf ) {
+    uint64_t u64 = htobe64 ( ( uint64_t ) s->timestamp );
+    uint32_t u32;
+    uint16_t u16;
+
+    memset ( buf, 0, SAMPLEWIRESIZE );
+    memcpy ( buf, &u64, 8 );
+    u32 = htobe32 ( s->seq );
+    memcpy ( buf + 8, &u32, 4 );
+    u32 = htobe32 ( ( uint32_t ) s->value );
+    memcpy ( buf + 12, &u32, 4 );
+    u16 = htobe16 ( s->sensorAddress );
+    memcpy ( buf + 16, &u16, 2 );
+    buf[18] = s->channel;
+    buf[19] = s->decimals;
+    buf[20] = ( unsigned char ) s->unit;
+}
+
+void SampleDecode ( const unsigned char * buf, Sample_t * s ) {
+    uint64_t u64;
+    uint32_t u32;
+    uint16_t u16;
+
+    memcpy ( &u64, buf, 8 );
+    s->timestamp = ( int64_t ) be64toh ( u64 );
+    memcpy ( &u32, buf + 8, 4 );
+    s->seq = be32toh ( u32 );
+    memcpy ( &u32, buf + 12, 4 );
+    s->value = ( int32_t ) be32toh ( u32 );
+    memcpy ( &u16, buf + 16, 2 );
+    s->sensorAddress = be16toh ( u16 );
+    s->channel = buf[18];
+    s->decimals = buf[19];
+    s->unit = ( char ) buf[20];
+}
+
+void SampleFormatValue ( const Sample_t * s, char * str, size_t len ) {
+    int32_t scale = 1;
+    int32_t v = s->value;
+
+    if ( s->decimals == 0 ) {
+        snprintf ( str, len, "%d", v );
+        return;
+    }
+    for ( int i = 0; i < s->decimals; i++ )
+        scale *= 10;
+    snprintf ( str, len, "%s%d.%0*d", ( v < 0 ) ? "-" : "",
+               ( v < 0 ? -v : v ) / scale, s->decimals, ( v < 0 ? -v : v ) % scale );
+}
+
+int64_t SampleTimeNow ( void ) {
+    struct timespec now;
+
+    clock_gettime ( CLOCK_REALTIME, &now );
+    return ( int64_t ) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
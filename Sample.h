@@ -0,0 +1,61 @@
+/*
+ * File:			Sample.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Measurement sample record and its network wire format
+ *
+ * <MIT License>
+ */
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SAMPLEWIRESIZE (24)				// Size of one sample on the network stream
+
+typedef struct {
+    int64_t timestamp;					// Time of reading, nanoseconds since epoch (CLOCK_REALTIME)
+    uint32_t seq;						// Per-sensor sequence number
+    int32_t value;						// Measured value, scaled by 10^decimals
+    uint16_t sensorAddress;				// Sensor address on the bus
+    uint8_t channel;					// Channel of multi-value sensors, 0 otherwise
+    uint8_t decimals;					// Number of decimal digits in value
+    char unit;							// Unit character as reported by the sensor
+} Sample_t;
+
+/**
+ * @brief   Convert a sample to network (big endian) wire format
+ *
+ * @param   s   sample to encode
+ * @param   buf output buffer, at least SAMPLEWIRESIZE bytes
+ */
+void SampleEncode ( const Sample_t * s, unsigned char * buf );
+
+/**
+ * @brief   Convert a sample from network wire format
+ *
+ * @param   buf input buffer, at least SAMPLEWIRESIZE bytes
+ * @param   s   decoded sample
+ */
+void SampleDecode ( const unsigned char * buf, Sample_t * s );
+
+/**
+ * @brief   Format the scaled value of a sample as decimal text
+ *
+ * @param   s   sample
+ * @param   str output string
+ * @param   len output buffer size
+ */
+void SampleFormatValue ( const Sample_t * s, char * str, size_t len );
+
+/**
+ * @brief   Current CLOCK_REALTIME in nanoseconds
+ *
+ * @return  int64_t
+ */
+int64_t SampleTimeNow ( void );
+
+#endif
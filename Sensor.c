@@ -0,0 +1,353 @@
+/*
+ * File:			Sensor.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Sensor drivers with retry policy and circuit breaker
+ *
+ * Every reading goes through SensorTransaction (), which retries a failed
+ * reading with doubling backoff; a group splits it into the first attempt
+ * of every member and then the retries of the failed ones. After a number
+ * of consecutive failed readings the breaker opens: the sensor is not
+ * touched for the cooldown time, so a broken device costs no bus time.
+ * Then a single probe reading decides whether the sensor is back or the
+ * cooldown is doubled.
+ *
+ * <MIT License>
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Sensor.h"
+#include "Crc8.h"
+#include "Trace.h"
+
+#define SCD30READDELAY (3)				// ms between command and read
+
+typedef int ( *SensorOperation_t ) ( Sensor_t * sensor, void * result );
+
+static int64_t MonotonicNs ( void ) {
+    struct timespec now;
+
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return ( int64_t ) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void SleepMs ( int ms ) {
+    struct timespec pause;
+
+    pause.tv_sec = ms / 1000;
+    pause.tv_nsec = ( long ) ( ms % 1000 ) * 1000000L;
+    while ( nanosleep ( &pause, &pause ) == -1 && errno == EINTR )
+        ;
+}
+
+static void BreakerOpen ( Sensor_t * sensor ) {
+    sensor->breakerState = BREAKER_OPEN;
+    sensor->counters.trips++;
+    sensor->probeAt = MonotonicNs () + ( int64_t ) sensor->cooldown * 1000000000LL;
+    BusClose ( &sensor->bus );									// Reopened by the probe
+}
+
+/**
+ * @brief Attempts of one reading, the probe of a half-open breaker gets no retries
+ */
+static int SensorAttempts ( const Sensor_t * sensor ) {
+    return ( sensor->breakerState == BREAKER_HALFOPEN ) ? 1 : 1 + sensor->retries;
+}
+
+/**
+ * @brief Run attempts first .. last - 1 of a reading, with doubling backoff before every retry
+ */
+static int SensorAttempt ( Sensor_t * sensor, SensorOperation_t operation, void * result, int first, int last ) {
+    int delay = sensor->backoff;
+    int rv;
+
+    for ( int i = 1; i < first; i++ )
+        delay *= 2;
+    for ( int i = first; i < last; i++ ) {
+        if ( i > 0 ) {
+            sensor->counters.retries++;
+            TRACE_BEGIN ( "backoff" );
+            SleepMs ( delay );
+            TRACE_END ( "backoff" );
+            delay *= 2;
+        }
+        if ( sensor->bus.fd == -1 ) {
+            sensor->started = false;									// Device may have been reset meanwhile
+            if ( BusOpen ( &sensor->bus, sensor->busPath, sensor->address, sensor->timeout,
+                           sensor->simModel, sensor->simFail, sensor->simWave ) == -1 ) {
+                sensor->lastError = errno;
+                continue;
+            }
+        }
+        TRACE_BEGIN ( "bus read" );
+        rv = operation ( sensor, result );
+        TRACE_END ( "bus read" );
+        if ( rv == 0 ) {
+            sensor->consecutiveFailures = 0;
+            if ( sensor->breakerState == BREAKER_HALFOPEN ) {
+                sensor->breakerState = BREAKER_CLOSED;
+                sensor->cooldown = sensor->cooldownBase;
+            }
+            return 0;
+        }
+        sensor->lastError = errno;
+        if ( sensor->lastError == ETIMEDOUT )
+            sensor->counters.timeouts++;
+    }
+    errno = sensor->lastError;
+    return -1;
+}
+
+/**
+ * @brief Count a failed reading and update the breaker
+ */
+static void SensorFailed ( Sensor_t * sensor ) {
+    sensor->counters.failures++;
+    sensor->consecutiveFailures++;
+    if ( sensor->breakerState == BREAKER_HALFOPEN ) {
+        sensor->cooldown = ( sensor->cooldown * 2 > MAXCOOLDOWN ) ? MAXCOOLDOWN : sensor->cooldown * 2;
+        BreakerOpen ( sensor );
+    } else if ( ( sensor->threshold > 0 ) && ( sensor->consecutiveFailures >= sensor->threshold ) ) {
+        BreakerOpen ( sensor );
+    }
+    errno = sensor->lastError;
+}
+
+/**
+ * @brief Run one reading with retries and update the breaker
+ */
+static int SensorTransaction ( Sensor_t * sensor, SensorOperation_t operation, void * result ) {
+    sensor->counters.readings++;
+    if ( SensorAttempt ( sensor, operation, result, 0, SensorAttempts ( sensor ) ) == 0 )
+        return 0;
+    SensorFailed ( sensor );
+    return -1;
+}
+
+int SensorInit ( Sensor_t * sensor, const ProcessArguments_t * args ) {
+    memset ( sensor, 0, sizeof ( *sensor ) );
+    strncpy ( sensor->busPath, args->bus, MAXBUSNAMELENGTH );
+    sensor->busPath[MAXBUSNAMELENGTH - 1] = '\0';
+    sensor->type = ( strcmp ( args->sensorType, "SCC" ) == 0 ) ? SENSOR_SCD30 : SENSOR_NTC;
+    sensor->address = args->sensorAddress;
+    sensor->interval = args->interval;
+    sensor->timeout = args->timeout;
+    sensor->retries = args->retries;
+    sensor->backoff = args->backoff;
+    sensor->threshold = args->breaker;
+    sensor->cooldownBase = args->cooldown;
+    sensor->cooldown = args->cooldown;
+    sensor->simModel = SIM_NTC;
+    sensor->simFail = args->simFail;
+    sensor->simWave = args->simWave;
+    sensor->breakerState = BREAKER_CLOSED;
+    sensor->bus.fd = -1;
+    if ( sensor->type == SENSOR_SCD30 ) {
+        sensor->simModel = SIM_SCD30;
+        if ( sensor->interval < SCD30MININTERVAL )
+            sensor->interval = SCD30MININTERVAL;
+        if ( sensor->timeout < SCD30MINTIMEOUT )
+            sensor->timeout = SCD30MINTIMEOUT;
+    }
+
+    return BusOpen ( &sensor->bus, sensor->busPath, sensor->address, sensor->timeout, sensor->simModel, sensor->simFail,
+                     sensor->simWave );
+}
+
+bool SensorReady ( Sensor_t * sensor ) {
+    if ( sensor->breakerState != BREAKER_OPEN )
+        return true;
+    if ( MonotonicNs () >= sensor->probeAt ) {
+        sensor->breakerState = BREAKER_HALFOPEN;
+        return true;
+    }
+    sensor->counters.skipped++;
+    return false;
+}
+
+typedef struct {
+    int16_t value;
+    char type;
+    char unit;
+} NTCReading_t;
+
+/**
+ * @brief Read one register of the SensorModule
+ */
+static int NTCRegister ( Sensor_t * sensor, uint8_t reg, uint8_t * buf, int len ) {
+    if ( BusWrite ( &sensor->bus, &reg, 1 ) == -1 )
+        return -1;
+    return BusRead ( &sensor->bus, buf, len );
+}
+
+static int NTCOperation ( Sensor_t * sensor, void * result ) {
+    NTCReading_t * reading = ( NTCReading_t * ) result;
+    uint8_t buf[2];
+
+    // Type and unit do not change, only read again after the bus was reopened
+    if ( !sensor->started ) {
+        if ( NTCRegister ( sensor, 2, buf, 1 ) == -1 )
+            return -1;
+        sensor->ntcType = ( char ) buf[0];
+        if ( NTCRegister ( sensor, 3, buf, 1 ) == -1 )
+            return -1;
+        sensor->ntcUnit = ( char ) buf[0];
+        sensor->started = true;
+    }
+    // Value, sent high byte first
+    sensor->sampledAt = MonotonicNs ();
+    if ( NTCRegister ( sensor, 1, buf, 2 ) == -1 )
+        return -1;
+    reading->value = ( int16_t ) ( ( buf[0] << 8 ) | buf[1] );
+    reading->type = sensor->ntcType;
+    reading->unit = sensor->ntcUnit;
+    return 0;
+}
+
+int SensorReadNTC ( Sensor_t * sensor, int16_t * value, char * type, char * unit ) {
+    NTCReading_t reading;
+
+    if ( SensorTransaction ( sensor, NTCOperation, &reading ) == -1 )
+        return -1;
+    *value = reading.value;
+    *type = reading.type;
+    *unit = reading.unit;
+    return 0;
+}
+
+int SensorTryNTC ( Sensor_t * sensor, int16_t * value, char * type, char * unit ) {
+    NTCReading_t reading;
+
+    sensor->counters.readings++;
+    if ( SensorAttempt ( sensor, NTCOperation, &reading, 0, 1 ) == -1 )
+        return -1;													// Pending, SensorRetryNTC finishes it
+    *value = reading.value;
+    *type = reading.type;
+    *unit = reading.unit;
+    return 0;
+}
+
+int SensorRetryNTC ( Sensor_t * sensor, int16_t * value, char * type, char * unit ) {
+    NTCReading_t reading;
+
+    if ( SensorAttempt ( sensor, NTCOperation, &reading, 1, SensorAttempts ( sensor ) ) == -1 ) {
+        SensorFailed ( sensor );
+        return -1;
+    }
+    *value = reading.value;
+    *type = reading.type;
+    *unit = reading.unit;
+    return 0;
+}
+
+typedef struct {
+    bool ready;
+    int32_t values[SCD30CHANNELS];
+} SCD30Reading_t;
+
+/**
+ * @brief Send an SCD30 command, with argument and its CRC if hasArgument
+ */
+static int SCD30Command ( Sensor_t * sensor, uint16_t command, bool hasArgument, uint16_t argument ) {
+    uint8_t buf[5];
+
+    buf[0] = ( uint8_t ) ( command >> 8 );
+    buf[1] = ( uint8_t ) command;
+    buf[2] = ( uint8_t ) ( argument >> 8 );
+    buf[3] = ( uint8_t ) argument;
+    buf[4] = Crc8 ( buf + 2, 2 );
+    return BusWrite ( &sensor->bus, buf, hasArgument ? 5 : 2 );
+}
+
+/**
+ * @brief Read words of an SCD30 command, each word is followed by its CRC
+ */
+static int SCD30ReadWords ( Sensor_t * sensor, uint16_t command, uint16_t * words, int count ) {
+    uint8_t buf[SCD30CHANNELS * 2 * 3];
+
+    if ( SCD30Command ( sensor, command, false, 0 ) == -1 )
+        return -1;
+    SleepMs ( SCD30READDELAY );									// Separate transfer, no repeated start
+    if ( BusRead ( &sensor->bus, buf, count * 3 ) == -1 )
+        return -1;
+    for ( int i = 0; i < count; i++ ) {
+        if ( Crc8 ( buf + i * 3, 2 ) != buf[i * 3 + 2] ) {
+            sensor->counters.crcErrors++;
+            errno = EBADMSG;
+            return -1;
+        }
+        words[i] = ( uint16_t ) ( ( buf[i * 3] << 8 ) | buf[i * 3 + 1] );
+    }
+    return 0;
+}
+
+static int SCD30Operation ( Sensor_t * sensor, void * result ) {
+    SCD30Reading_t * reading = ( SCD30Reading_t * ) result;
+    uint16_t words[SCD30CHANNELS * 2];
+    uint32_t raw;
+    float value;
+
+    reading->ready = false;
+    // Continuous measurement, the sensor keeps it across readings but not across a reset
+    if ( !sensor->started ) {
+        if ( ( SCD30Command ( sensor, 0x4600, true, ( uint16_t ) sensor->interval ) == -1 )
+                || ( SCD30Command ( sensor, 0x0010, true, 0 ) == -1 ) )		// No pressure compensation
+            return -1;
+        sensor->started = true;
+        return 0;
+    }
+    // Data ready flag, the measurement is only read when there is a new one
+    if ( SCD30ReadWords ( sensor, 0x0202, words, 1 ) == -1 )
+        return -1;
+    if ( words[0] != 1 )
+        return 0;
+    // CO2, temperature and humidity as big endian floats in one transfer
+    sensor->sampledAt = MonotonicNs ();
+    if ( SCD30ReadWords ( sensor, 0x0300, words, SCD30CHANNELS * 2 ) == -1 )
+        return -1;
+    for ( int i = 0; i < SCD30CHANNELS; i++ ) {
+        raw = ( ( uint32_t ) words[i * 2] << 16 ) | words[i * 2 + 1];
+        memcpy ( &value, &raw, sizeof ( value ) );
+        value *= 100.0f;
+        reading->values[i] = ( int32_t ) ( value + ( ( value < 0 ) ? -0.5f : 0.5f ) );
+    }
+    reading->ready = true;
+    return 0;
+}
+
+int SensorReadSCD30 ( Sensor_t * sensor, int32_t values[SCD30CHANNELS] ) {
+    SCD30Reading_t reading;
+
+    if ( SensorTransaction ( sensor, SCD30Operation, &reading ) == -1 )
+        return -1;
+    if ( !reading.ready ) {
+        sensor->counters.notReady++;
+        return 1;
+    }
+    memcpy ( values, reading.values, sizeof ( reading.values ) );
+    return 0;
+}
+
+const char * SensorStateName ( int state ) {
+    switch ( state ) {
+    case BREAKER_CLOSED:
+        return "active";
+    case BREAKER_OPEN:
+        return "suspended";
+    case BREAKER_HALFOPEN:
+        return "probing";
+    default:
+        return "unknown";
+    }
+}
+
+void SensorClose ( Sensor_t * sensor ) {
+    BusClose ( &sensor->bus );
+}
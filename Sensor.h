@@ -0,0 +1,158 @@
+/*
+ * File:			Sensor.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Sensor drivers with retry policy and circuit breaker
+ *
+ * <MIT License>
+ */
+
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ProcArgs.h"
+#include "I2CBus.h"
+
+#define BREAKER_CLOSED (0)				// Sensor is read normally
+#define BREAKER_OPEN (1)				// Sensor is suspended, not read at all
+#define BREAKER_HALFOPEN (2)			// One probe reading decides
+
+#define MAXCOOLDOWN (300)				// s, limit of the doubling suspend time
+
+#define SENSOR_NTC (0)					// SensorModule NTC
+#define SENSOR_SCD30 (1)				// Sensirion SCD30 CO2, temperature, humidity
+
+#define SCD30CHANNELS (3)				// CO2 ppm, temperature C, relative humidity %
+#define SCD30DECIMALS (2)				// Values are scaled by 100
+#define SCD30MININTERVAL (2)			// s, shortest measurement interval of the sensor
+#define SCD30MINTIMEOUT (150)			// ms, the sensor stretches the clock this long
+
+typedef struct {
+    uint32_t readings;					// Readings attempted
+    uint32_t failures;					// Readings failed after all retries
+    uint32_t retries;					// Extra attempts
+    uint32_t timeouts;					// Transfers that timed out
+    uint32_t skipped;					// Readings skipped while suspended
+    uint32_t trips;						// Times the breaker opened
+    uint32_t notReady;					// Polls without new data
+    uint32_t crcErrors;					// Transfers with a CRC mismatch
+    int32_t breakerState;
+} SensorCounters_t;
+
+typedef struct {
+    I2CBus_t bus;
+    char busPath[MAXBUSNAMELENGTH];
+    int type;							// SENSOR_NTC or SENSOR_SCD30
+    int address;
+    int interval;						// Measurement interval of the sensor in s
+    bool started;						// Set up since the bus was opened: SCD30 measuring, NTC type and unit read
+    char ntcType;						// Type and unit of the NTC module, constant, read once
+    char ntcUnit;
+    int64_t sampledAt;					// CLOCK_MONOTONIC ns of the last value transfer
+    int timeout;						// Transfer timeout in ms
+    int retries;						// Retries of a failed reading
+    int backoff;						// First retry delay in ms
+    int threshold;						// Consecutive failures opening the breaker
+    int cooldownBase;					// s
+    int cooldown;						// Current suspend time in s
+    int simModel;
+    int simFail;
+    int simWave;
+    int consecutiveFailures;
+    int lastError;						// errno of the last failed attempt
+    int breakerState;
+    int64_t probeAt;					// CLOCK_MONOTONIC ns of next probe when open
+    SensorCounters_t counters;
+} Sensor_t;
+
+/**
+ * @brief   Set up sensor and open the bus
+ *          A failed open is handled like a failed reading, so the breaker keeps
+ *          a sensor that can not be opened from being hammered.
+ *
+ * @param   sensor  sensor state
+ * @param   args    process arguments
+ * @return  int     0 on success, -1 with errno set if the bus could not be opened
+ */
+int SensorInit ( Sensor_t * sensor, const ProcessArguments_t * args );
+
+/**
+ * @brief   Check the breaker before a reading
+ *          Returns false while the sensor is suspended, then lets one probe through.
+ *
+ * @param   sensor  sensor state
+ * @return  bool    true if the sensor should be read now
+ */
+bool SensorReady ( Sensor_t * sensor );
+
+/**
+ * @brief   Read a SensorModule NTC sensor
+ *          Type and unit are read once after the bus was opened, a reading
+ *          is one value transfer, timed in sampledAt.
+ *
+ * @param   sensor  sensor state
+ * @param   value   measured value
+ * @param   type    sensor type character
+ * @param   unit    unit character
+ * @return  int     0 on success, -1 with errno of the last failure
+ */
+int SensorReadNTC ( Sensor_t * sensor, int16_t * value, char * type, char * unit );
+
+/**
+ * @brief   First attempt of an NTC reading, without retries
+ *          A failed attempt leaves the reading pending, it must be finished
+ *          with SensorRetryNTC. Lets a group read every member once before
+ *          any retry or backoff delays the others.
+ *
+ * @param   sensor  sensor state
+ * @param   value   measured value
+ * @param   type    sensor type character
+ * @param   unit    unit character
+ * @return  int     0 on success, -1 with errno if the reading is pending
+ */
+int SensorTryNTC ( Sensor_t * sensor, int16_t * value, char * type, char * unit );
+
+/**
+ * @brief   Retries of a reading left pending by SensorTryNTC
+ *          Same backoff and breaker handling as SensorReadNTC.
+ *
+ * @param   sensor  sensor state
+ * @param   value   measured value
+ * @param   type    sensor type character
+ * @param   unit    unit character
+ * @return  int     0 on success, -1 with errno of the last failure
+ */
+int SensorRetryNTC ( Sensor_t * sensor, int16_t * value, char * type, char * unit );
+
+/**
+ * @brief   Read an SCD30 in continuous measurement mode
+ *          Starts the measurement if needed, then polls the data ready flag and
+ *          reads CO2, temperature and humidity in one transfer only if new data is
+ *          there. Every word is CRC checked, a mismatch fails the reading.
+ *
+ * @param   sensor  sensor state
+ * @param   values  CO2 ppm, temperature C and relative humidity %, scaled by 100
+ * @return  int     0 on new values, 1 if no new data yet, -1 with errno of the last failure
+ */
+int SensorReadSCD30 ( Sensor_t * sensor, int32_t values[SCD30CHANNELS] );
+
+/**
+ * @brief   Human readable breaker state
+ *
+ * @param   state   BREAKER_CLOSED, BREAKER_OPEN or BREAKER_HALFOPEN
+ * @return  const char*
+ */
+const char * SensorStateName ( int state );
+
+/**
+ * @brief   Close the bus
+ *
+ * @param   sensor  sensor state
+ */
+void SensorClose ( Sensor_t * sensor );
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * File:			SimDevice.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Simulated I2C sensors for testing without hardware
+ *
+ * <MIT License>
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "SimDevice.h"
+#include "Crc8.h"
+
+/**
+ * @brief Decide whether the next transfer fails
+ */
+static int SimFail ( SimDevice_t * sim ) {
+    if ( ( sim->failPercent > 0 ) && ( ( int ) ( rand_r ( &sim->seed ) % 100 ) < sim->failPercent ) ) {
+        errno = EIO;
+        return 1;
+    }
+    return 0;
+}
+
+static int64_t SimNow ( void ) {
+    struct timespec now;
+
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return ( int64_t ) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * @brief Number of finished measurement periods of the SCD30
+ */
+static int64_t SimPeriod ( const SimDevice_t * sim ) {
+    if ( !sim->measuring )
+        return 0;
+    return ( SimNow () - sim->start ) / ( ( int64_t ) sim->interval * 1000000000LL );
+}
+
+/**
+ * @brief Put a 16 bit word and its CRC into a read buffer
+ */
+static void SimWord ( uint8_t * buf, uint16_t word ) {
+    buf[0] = ( uint8_t ) ( word >> 8 );
+    buf[1] = ( uint8_t ) word;
+    buf[2] = Crc8 ( buf, 2 );
+}
+
+/**
+ * @brief Put a float as two words with CRC, big endian
+ */
+static void SimFloat ( uint8_t * buf, float value ) {
+    uint32_t raw;
+
+    memcpy ( &raw, &value, sizeof ( raw ) );
+    SimWord ( buf, ( uint16_t ) ( raw >> 16 ) );
+    SimWord ( buf + 3, ( uint16_t ) raw );
+}
+
+/**
+ * @brief SCD30 command: 16 bit command, optionally 16 bit argument and CRC
+ */
+static int SimSCD30Write ( SimDevice_t * sim, const uint8_t * buf, int len ) {
+    uint16_t argument = 0;
+
+    if ( ( len != 2 ) && ( len != 5 ) ) {
+        errno = EIO;
+        return -1;
+    }
+    if ( len == 5 ) {
+        if ( Crc8 ( buf + 2, 2 ) != buf[4] ) {						// Device does not acknowledge
+            errno = EIO;
+            return -1;
+        }
+        argument = ( uint16_t ) ( ( buf[2] << 8 ) | buf[3] );
+    }
+    sim->command = ( uint16_t ) ( ( buf[0] << 8 ) | buf[1] );
+
+    switch ( sim->command ) {
+    case 0x0010:												// Start continuous measurement
+        sim->measuring = 1;
+        sim->start = SimNow ();
+        sim->lastPeriod = 0;
+        break;
+    case 0x0104:												// Stop continuous measurement
+        sim->measuring = 0;
+        break;
+    case 0x4600:												// Set measurement interval
+        if ( ( len == 5 ) && ( argument >= 2 ) && ( argument <= 1800 ) ) {
+            sim->interval = argument;
+            sim->start = SimNow ();
+            sim->lastPeriod = 0;
+        }
+        break;
+    default:
+        break;
+    }
+    return len;
+}
+
+static int SimSCD30Read ( SimDevice_t * sim, uint8_t * buf, int len ) {
+    uint8_t data[18];
+    int64_t period = SimPeriod ( sim );
+
+    memset ( data, 0, sizeof ( data ) );
+    switch ( sim->command ) {
+    case 0x0202:												// Data ready status
+        SimWord ( data, ( period > sim->lastPeriod ) ? 1 : 0 );
+        break;
+    case 0x0300:												// Read measurement: CO2, T, RH
+        SimFloat ( data, 400.0f + sim->address + ( float ) ( rand_r ( &sim->seed ) % 100 ) / 4.0f );
+        SimFloat ( data + 6, 22.5f + ( float ) ( rand_r ( &sim->seed ) % 20 ) / 10.0f );
+        SimFloat ( data + 12, 45.0f + ( float ) ( rand_r ( &sim->seed ) % 50 ) / 10.0f );
+        sim->lastPeriod = period;
+        break;
+    default:
+        break;
+    }
+    if ( len > ( int ) sizeof ( data ) )
+        len = sizeof ( data );
+    memcpy ( buf, data, len );
+
+    // Injected failures corrupt the data, the CRC check has to catch them
+    if ( ( sim->failPercent > 0 ) && ( ( int ) ( rand_r ( &sim->seed ) % 100 ) < sim->failPercent ) )
+        buf[rand_r ( &sim->seed ) % len] ^= 0x10;
+    return len;
+}
+
+void SimInit ( SimDevice_t * sim, int model, int address, int failPercent, int wave ) {
+    memset ( sim, 0, sizeof ( *sim ) );
+    sim->model = model;
+    sim->address = address;
+    sim->failPercent = failPercent;
+    sim->wave = wave;
+    sim->seed = ( unsigned int ) getpid () ^ ( unsigned int ) time ( NULL ) ^ ( unsigned int ) address;
+    sim->interval = 2;
+}
+
+int SimWrite ( SimDevice_t * sim, const uint8_t * buf, int len ) {
+    if ( sim->model == SIM_SCD30 )
+        return SimSCD30Write ( sim, buf, len );
+    if ( SimFail ( sim ) )
+        return -1;
+    if ( len > 0 )
+        sim->reg = buf[0];
+    return len;
+}
+
+int SimRead ( SimDevice_t * sim, uint8_t * buf, int len ) {
+    int16_t value;
+    int level;
+
+    if ( sim->model == SIM_SCD30 )
+        return SimSCD30Read ( sim, buf, len );
+    if ( SimFail ( sim ) )
+        return -1;
+    memset ( buf, 0, len );
+
+    // SensorModule NTC: 1 - value (big endian), 2 - type, 3 - unit
+    switch ( sim->reg ) {
+    case 1:
+        if ( sim->wave > 0 ) {
+            level = sim->readings++ % sim->wave;
+            value = 200 + sim->address + ( int16_t ) ( ( level <= sim->wave / 2 ) ? level : sim->wave - level );
+        } else {
+            value = 200 + sim->address + ( int16_t ) ( rand_r ( &sim->seed ) % 5 );
+        }
+        buf[0] = ( uint8_t ) ( value >> 8 );
+        if ( len > 1 )
+            buf[1] = ( uint8_t ) value;
+        break;
+    case 2:
+        buf[0] = 'T';
+        break;
+    case 3:
+        buf[0] = 'C';
+        break;
+    default:
+        break;
+    }
+    return len;
+}
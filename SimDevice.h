@@ -0,0 +1,62 @@
+/*
+ * File:			SimDevice.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Simulated I2C sensors for testing without hardware
+ *
+ * <MIT License>
+ */
+
+#ifndef SIMDEVICE_H
+#define SIMDEVICE_H
+
+#include <stdint.h>
+
+#define SIM_NTC (0)						// SensorModule NTC register model
+#define SIM_SCD30 (1)					// Sensirion SCD30 command model
+
+typedef struct {
+    int model;							// SIM_NTC or SIM_SCD30
+    int failPercent;					// Chance of a failed transfer (SCD30: corrupted data)
+    unsigned int seed;					// Random state
+    uint8_t reg;						// Register pointer
+    int address;
+    // NTC
+    int wave;							// Readings per period of a triangle wave, 0 - random values
+    uint32_t readings;					// Values read, position on the wave
+    // SCD30
+    uint16_t command;					// Last command, selects what a read returns
+    int measuring;						// Continuous measurement running
+    uint16_t interval;					// Measurement interval in s
+    int64_t start;						// Start of continuous measurement (CLOCK_MONOTONIC ns)
+    int64_t lastPeriod;					// Measurement period already read out
+} SimDevice_t;
+
+/**
+ * @brief   Initialize a simulated device
+ *
+ * @param   sim         device state
+ * @param   model       device model
+ * @param   address     bus address, also seeds the simulated values
+ * @param   failPercent chance (0-100) of each transfer failing
+ * @param   wave        NTC: readings per period of a triangle wave from 200 + address
+ *                      up by wave / 2 and back, 0 - random values
+ */
+void SimInit ( SimDevice_t * sim, int model, int address, int failPercent, int wave );
+
+/**
+ * @brief   Write to the simulated device
+ *
+ * @return  int     number of bytes written, -1 with errno set on failure
+ */
+int SimWrite ( SimDevice_t * sim, const uint8_t * buf, int len );
+
+/**
+ * @brief   Read from the simulated device
+ *
+ * @return  int     number of bytes read, -1 with errno set on failure
+ */
+int SimRead ( SimDevice_t * sim, uint8_t * buf, int len );
+
+#endif
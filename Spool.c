@@ -0,0 +1,243 @@
+/*
+ * File:			Spool.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Disk-backed store-and-forward queue for the sample stream
+ *
+ * The spool is a directory of numbered segment files (00000001.seg, ...),
+ * each holding up to SPOOLSEGMENTRECORDS samples in stream wire format.
+ * Samples are appended to the newest segment and replayed from the oldest.
+ * Fully replayed segments are deleted. The read position is saved to the
+ * file "cursor" on close; after a crash the oldest segment is replayed
+ * from its beginning, so a consumer may see duplicates (same seq) but no gaps.
+ *
+ * <MIT License>
+ */
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Spool.h"
+
+#define MAXPATHLENGTH (MAXFILENAMELENGTH + 16)
+
+static void SegmentPath ( const Spool_t * spool, uint32_t segment, char * path ) {
+    snprintf ( path, MAXPATHLENGTH, "%s/%08u.seg", spool->dir, segment );
+}
+
+static uint32_t SegmentRecords ( const Spool_t * spool, uint32_t segment ) {
+    char path[MAXPATHLENGTH];
+    struct stat st;
+
+    SegmentPath ( spool, segment, path );
+    if ( stat ( path, &st ) == -1 )
+        return 0;
+    return st.st_size / SAMPLEWIRESIZE;
+}
+
+/**
+ * @brief Delete the oldest segment, whatever is left unread in it is dropped
+ */
+static void DropFirstSegment ( Spool_t * spool ) {
+    char path[MAXPATHLENGTH];
+    uint32_t records = SegmentRecords ( spool, spool->firstSegment );
+    uint32_t remaining = ( records > spool->readOffset ) ? records - spool->readOffset : 0;
+
+    if ( remaining > spool->queued )
+        remaining = spool->queued;
+    spool->queued -= remaining;
+    spool->dropped += remaining;
+
+    if ( spool->readFd != -1 )
+        close ( spool->readFd );
+    spool->readFd = -1;
+    SegmentPath ( spool, spool->firstSegment, path );
+    unlink ( path );
+    spool->firstSegment++;
+    spool->readOffset = 0;
+}
+
+int SpoolOpen ( Spool_t * spool, const char * dir, int budgetMB ) {
+    DIR * d;
+    struct dirent * entry;
+    char path[MAXPATHLENGTH];
+    FILE * cursor;
+    uint32_t segment, offset;
+    bool found = false;
+
+    memset ( spool, 0, sizeof ( *spool ) );
+    strncpy ( spool->dir, dir, MAXFILENAMELENGTH );
+    spool->dir[MAXFILENAMELENGTH - 1] = '\0';
+    spool->readFd = -1;
+    spool->writeFd = -1;
+    spool->budget = ( uint64_t ) budgetMB * 1024 * 1024;
+    if ( spool->budget < 2 * SPOOLSEGMENTRECORDS * SAMPLEWIRESIZE )
+        spool->budget = 2 * SPOOLSEGMENTRECORDS * SAMPLEWIRESIZE;
+
+    if ( ( mkdir ( dir, 0755 ) == -1 ) && ( errno != EEXIST ) )
+        return -1;
+    if ( ( d = opendir ( dir ) ) == NULL )
+        return -1;
+
+    // Find the range of existing segments
+    spool->firstSegment = 1;
+    while ( ( entry = readdir ( d ) ) != NULL ) {
+        if ( ( strlen ( entry->d_name ) != 12 ) || ( sscanf ( entry->d_name, "%8u.seg", &segment ) != 1 ) )
+            continue;
+        if ( !found || ( segment < spool->firstSegment ) )
+            spool->firstSegment = segment;
+        if ( !found || ( segment > spool->lastSegment ) )
+            spool->lastSegment = segment;
+        found = true;
+    }
+    closedir ( d );
+
+    snprintf ( path, MAXPATHLENGTH, "%s/cursor", dir );
+    if ( !found ) {
+        // Numbering starts over, an old read position would apply to the new first segment
+        unlink ( path );
+        spool->lastSegment = spool->firstSegment - 1;					// Empty range
+        return 0;
+    }
+
+    for ( segment = spool->firstSegment; segment <= spool->lastSegment; segment++ )
+        spool->queued += SegmentRecords ( spool, segment );
+
+    if ( ( cursor = fopen ( path, "r" ) ) != NULL ) {
+        if ( ( fscanf ( cursor, "%u %u", &segment, &offset ) == 2 ) && ( segment == spool->firstSegment )
+                && ( offset <= spool->queued ) ) {
+            spool->readOffset = offset;
+            spool->queued -= offset;
+        }
+        fclose ( cursor );
+    }
+
+    // Continue writing the newest segment, cut off a partially written record
+    SegmentPath ( spool, spool->lastSegment, path );
+    spool->writeFd = open ( path, O_WRONLY | O_APPEND );
+    if ( spool->writeFd == -1 )
+        return -1;
+    spool->writeCount = SegmentRecords ( spool, spool->lastSegment );
+    ftruncate ( spool->writeFd, ( off_t ) spool->writeCount * SAMPLEWIRESIZE );
+    return 0;
+}
+
+int SpoolPush ( Spool_t * spool, const Sample_t * s ) {
+    unsigned char wire[SAMPLEWIRESIZE];
+    char path[MAXPATHLENGTH];
+
+    if ( ( spool->writeFd == -1 ) || ( spool->writeCount == SPOOLSEGMENTRECORDS ) ) {
+        if ( spool->writeFd != -1 )
+            close ( spool->writeFd );
+        spool->lastSegment++;
+        spool->writeCount = 0;
+        SegmentPath ( spool, spool->lastSegment, path );
+        spool->writeFd = open ( path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644 );
+        if ( spool->writeFd == -1 )
+            return -1;
+    }
+
+    SampleEncode ( s, wire );
+    if ( write ( spool->writeFd, wire, SAMPLEWIRESIZE ) != SAMPLEWIRESIZE )
+        return -1;
+    spool->writeCount++;
+    spool->queued++;
+    spool->written++;
+
+    // Stay within the disk budget, the oldest data goes first
+    while ( ( ( spool->queued + spool->readOffset ) * SAMPLEWIRESIZE > spool->budget )
+            && ( spool->firstSegment < spool->lastSegment ) ) {
+        DropFirstSegment ( spool );
+    }
+    return 0;
+}
+
+int SpoolPeek ( Spool_t * spool, Sample_t * s ) {
+    unsigned char wire[SAMPLEWIRESIZE];
+    char path[MAXPATHLENGTH];
+
+    while ( spool->queued > 0 ) {
+        if ( spool->readFd == -1 ) {
+            SegmentPath ( spool, spool->firstSegment, path );
+            spool->readFd = open ( path, O_RDONLY );
+        }
+        if ( ( spool->readFd != -1 )
+                && ( pread ( spool->readFd, wire, SAMPLEWIRESIZE, ( off_t ) spool->readOffset * SAMPLEWIRESIZE ) == SAMPLEWIRESIZE ) ) {
+            SampleDecode ( wire, s );
+            return 0;
+        }
+        if ( spool->firstSegment >= spool->lastSegment )
+            return -1;
+        DropFirstSegment ( spool );										// Missing or short segment, skip it
+    }
+    return -1;
+}
+
+void SpoolAdvance ( Spool_t * spool ) {
+    char path[MAXPATHLENGTH];
+
+    if ( spool->queued == 0 )
+        return;
+    spool->queued--;
+    spool->readOffset++;
+
+    if ( ( spool->queued == 0 ) && ( spool->firstSegment == spool->lastSegment ) ) {
+        // Everything replayed, start over with an empty spool
+        if ( spool->readFd != -1 )
+            close ( spool->readFd );
+        if ( spool->writeFd != -1 )
+            close ( spool->writeFd );
+        spool->readFd = -1;
+        spool->writeFd = -1;
+        SegmentPath ( spool, spool->firstSegment, path );
+        unlink ( path );
+        snprintf ( path, MAXPATHLENGTH, "%s/cursor", spool->dir );
+        unlink ( path );
+        spool->firstSegment = spool->lastSegment + 1;
+        spool->readOffset = 0;
+    } else if ( ( spool->readOffset == SPOOLSEGMENTRECORDS ) && ( spool->firstSegment < spool->lastSegment ) ) {
+        DropFirstSegment ( spool );										// Nothing left to drop in it
+    }
+}
+
+bool SpoolEmpty ( const Spool_t * spool ) {
+    return spool->queued == 0;
+}
+
+void SpoolSync ( Spool_t * spool ) {
+    if ( spool->writeFd != -1 )
+        fdatasync ( spool->writeFd );
+}
+
+void SpoolClose ( Spool_t * spool ) {
+    char path[MAXPATHLENGTH];
+    FILE * cursor;
+
+    SpoolSync ( spool );
+    snprintf ( path, MAXPATHLENGTH, "%s/cursor", spool->dir );
+    if ( spool->queued > 0 ) {
+        if ( ( cursor = fopen ( path, "w" ) ) != NULL ) {
+            fprintf ( cursor, "%u %u\n", spool->firstSegment, spool->readOffset );
+            fflush ( cursor );
+            fsync ( fileno ( cursor ) );
+            fclose ( cursor );
+        }
+    } else {
+        unlink ( path );
+    }
+    if ( spool->readFd != -1 )
+        close ( spool->readFd );
+    if ( spool->writeFd != -1 )
+        close ( spool->writeFd );
+    spool->readFd = -1;
+    spool->writeFd = -1;
+}
@@ -0,0 +1,96 @@
+/*
+ * File:			Spool.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Disk-backed store-and-forward queue for the sample stream
+ *
+ * <MIT License>
+ */
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ProcArgs.h"
+#include "Sample.h"
+
+#define SPOOLSEGMENTRECORDS (4096)		// Samples per segment file
+#define DEFAULTSPOOLBUDGET (64)			// MB of disk the spool may use
+#define DEFAULTCATCHUPRATE (50)			// Samples replayed per second
+
+typedef struct {
+    char dir[MAXFILENAMELENGTH];
+    uint32_t firstSegment;				// Oldest segment, read side
+    uint32_t lastSegment;				// Newest segment, write side
+    int readFd;							// -1 if no segment open for reading
+    int writeFd;						// -1 if no segment open for writing
+    uint32_t readOffset;				// Records already forwarded from first segment
+    uint32_t writeCount;				// Records in last segment
+    uint64_t queued;					// Records waiting in the spool
+    uint64_t budget;					// Disk budget in bytes
+    uint64_t dropped;					// Records discarded to stay within budget
+    uint64_t written;					// Records ever spooled
+} Spool_t;
+
+/**
+ * @brief   Open (or create) the spool directory and continue a previous spool
+ *
+ * @param   spool       spool state
+ * @param   dir         spool directory
+ * @param   budgetMB    disk budget in megabytes, at least two segments are kept
+ * @return  int         0 on success, -1 on error
+ */
+int SpoolOpen ( Spool_t * spool, const char * dir, int budgetMB );
+
+/**
+ * @brief   Append a sample to the end of the spool
+ *          When the budget is exceeded the oldest segment is discarded.
+ *
+ * @param   spool   spool state
+ * @param   s       sample
+ * @return  int     0 on success, -1 on write error
+ */
+int SpoolPush ( Spool_t * spool, const Sample_t * s );
+
+/**
+ * @brief   Read the oldest sample without removing it
+ *
+ * @param   spool   spool state
+ * @param   s       sample
+ * @return  int     0 on success, -1 if the spool is empty or unreadable
+ */
+int SpoolPeek ( Spool_t * spool, Sample_t * s );
+
+/**
+ * @brief   Remove the oldest sample, after it was forwarded
+ *
+ * @param   spool   spool state
+ */
+void SpoolAdvance ( Spool_t * spool );
+
+/**
+ * @brief   True if there is nothing to replay
+ *
+ * @param   spool   spool state
+ * @return  bool
+ */
+bool SpoolEmpty ( const Spool_t * spool );
+
+/**
+ * @brief   Flush spooled data to disk
+ *
+ * @param   spool   spool state
+ */
+void SpoolSync ( Spool_t * spool );
+
+/**
+ * @brief   Save read position, flush and close the spool
+ *
+ * @param   spool   spool state
+ */
+void SpoolClose ( Spool_t * spool );
+
+#endif
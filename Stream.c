@@ -0,0 +1,139 @@
+/*
+ * File:			Stream.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Sample stream server, forwards measurements to remote consumers
+ *
+ * <MIT License>
+ */
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <errno.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Net.h"
+#include "Stream.h"
+
+static void StreamDrop ( Stream_t * stream, int i ) {
+    close ( stream->consumers[i].fd );
+    stream->count--;
+    if ( i != stream->count ) {
+        // Keep the list dense, move the last consumer into the gap
+        stream->consumers[i].fd = stream->consumers[stream->count].fd;
+        stream->consumers[i].len = stream->consumers[stream->count].len;
+        memcpy ( stream->consumers[i].out, stream->consumers[stream->count].out, stream->consumers[i].len );
+    }
+}
+
+/**
+ * @brief Write pending output of one consumer
+ *
+ * @return int  0 if consumer is alive, -1 if connection is lost
+ */
+static int StreamFlushConsumer ( StreamConsumer_t * c ) {
+    ssize_t n;
+
+    while ( c->len > 0 ) {
+        n = send ( c->fd, c->out, c->len, MSG_DONTWAIT | MSG_NOSIGNAL );
+        if ( n == -1 ) {
+            if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) )
+                return 0;
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+        memmove ( c->out, c->out + n, c->len - n );
+        c->len -= n;
+    }
+    return 0;
+}
+
+int StreamOpen ( Stream_t * stream, const char * port ) {
+    memset ( stream, 0, sizeof ( *stream ) );
+    stream->listener = NetListen ( port );
+    return ( stream->listener == -1 ) ? -1 : 0;
+}
+
+int StreamPoll ( Stream_t * stream ) {
+    int accepted = 0;
+    int fd;
+    char scratch[64];
+    ssize_t n;
+
+    // Accept new consumers
+    while ( ( fd = accept ( stream->listener, NULL, 0 ) ) != -1 ) {
+        if ( stream->count == MAXCONSUMERS ) {
+            close ( fd );
+            continue;
+        }
+        NetSetNonBlocking ( fd );
+        stream->consumers[stream->count].fd = fd;
+        stream->consumers[stream->count].len = 0;
+        stream->count++;
+        accepted++;
+    }
+
+    // Consumers do not send anything, readable means closed (or garbage to discard)
+    for ( int i = stream->count - 1; i >= 0; i-- ) {
+        n = recv ( stream->consumers[i].fd, scratch, sizeof ( scratch ), MSG_DONTWAIT );
+        if ( ( n == 0 ) || ( ( n == -1 ) && ( errno != EAGAIN ) && ( errno != EWOULDBLOCK ) && ( errno != EINTR ) )
+                || ( StreamFlushConsumer ( &stream->consumers[i] ) == -1 ) ) {
+            StreamDrop ( stream, i );
+        }
+    }
+    return accepted;
+}
+
+int StreamSend ( Stream_t * stream, const Sample_t * s ) {
+    unsigned char wire[SAMPLEWIRESIZE];
+    int queued = 0;
+
+    SampleEncode ( s, wire );
+    for ( int i = stream->count - 1; i >= 0; i-- ) {
+        StreamConsumer_t * c = &stream->consumers[i];
+        if ( c->len + SAMPLEWIRESIZE > STREAMBUFSIZE ) {
+            StreamFlushConsumer ( c );
+        }
+        if ( c->len + SAMPLEWIRESIZE > STREAMBUFSIZE ) {	// Consumer does not keep up
+            stream->dropped++;
+            StreamDrop ( stream, i );
+            continue;
+        }
+        memcpy ( c->out + c->len, wire, SAMPLEWIRESIZE );
+        c->len += SAMPLEWIRESIZE;
+        if ( StreamFlushConsumer ( c ) == -1 ) {
+            StreamDrop ( stream, i );
+            continue;
+        }
+        queued++;
+    }
+    if ( queued > 0 )
+        stream->sent++;
+    return queued;
+}
+
+int StreamRoom ( const Stream_t * stream ) {
+    size_t room = STREAMBUFSIZE;
+
+    for ( int i = 0; i < stream->count; i++ ) {
+        if ( STREAMBUFSIZE - stream->consumers[i].len < room )
+            room = STREAMBUFSIZE - stream->consumers[i].len;
+    }
+    return ( stream->count == 0 ) ? 0 : ( int ) ( room / SAMPLEWIRESIZE );
+}
+
+void StreamClose ( Stream_t * stream ) {
+    for ( int i = 0; i < stream->count; i++ ) {
+        StreamFlushConsumer ( &stream->consumers[i] );
+        close ( stream->consumers[i].fd );
+    }
+    stream->count = 0;
+    if ( stream->listener != -1 )
+        close ( stream->listener );
+    stream->listener = -1;
+}
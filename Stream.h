@@ -0,0 +1,78 @@
+/*
+ * File:			Stream.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Sample stream server, forwards measurements to remote consumers
+ *
+ * <MIT License>
+ */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "Sample.h"
+
+#define MAXCONSUMERS (8)
+#define STREAMBUFSIZE (256 * SAMPLEWIRESIZE)	// Per consumer output buffer
+
+typedef struct {
+    int fd;
+    unsigned char out[STREAMBUFSIZE];	// Encoded samples not yet accepted by the kernel
+    size_t len;
+} StreamConsumer_t;
+
+typedef struct {
+    int listener;
+    StreamConsumer_t consumers[MAXCONSUMERS];
+    int count;							// Connected consumers
+    uint64_t sent;						// Samples queued to at least one consumer
+    uint64_t dropped;					// Consumers dropped for being too slow
+} Stream_t;
+
+/**
+ * @brief   Start listening for stream consumers
+ *
+ * @param   stream  stream state
+ * @param   port    port number as string
+ * @return  int     0 on success, -1 on error
+ */
+int StreamOpen ( Stream_t * stream, const char * port );
+
+/**
+ * @brief   Accept new consumers, detect closed ones and flush pending output
+ *          Never blocks. Call once per main loop iteration.
+ *
+ * @param   stream  stream state
+ * @return  int     number of newly connected consumers
+ */
+int StreamPoll ( Stream_t * stream );
+
+/**
+ * @brief   Queue one sample to every connected consumer
+ *
+ * @param   stream  stream state
+ * @param   s       sample
+ * @return  int     number of consumers the sample was queued to
+ */
+int StreamSend ( Stream_t * stream, const Sample_t * s );
+
+/**
+ * @brief   Number of samples every consumer can take without dropping
+ *
+ * @param   stream  stream state
+ * @return  int
+ */
+int StreamRoom ( const Stream_t * stream );
+
+/**
+ * @brief   Close listener and all consumers
+ *
+ * @param   stream  stream state
+ */
+void StreamClose ( Stream_t * stream );
+
+#endif
@@ -0,0 +1,191 @@
+/*
+ * File:			Trace.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Event tracer, begin/end of the loop phases in Chrome trace format
+ *
+ * Recording only stores a time, a pointer and a byte in a ring buffer of the
+ * process; formatting and writing happen in TraceDump. All processes append
+ * whole lines to the same file opened with O_APPEND, the result loads in
+ * chrome://tracing or Perfetto as one timeline (CLOCK_MONOTONIC, us).
+ *
+ * <MIT License>
+ */
+
+#define _GNU_SOURCE				// sigtimedwait
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "Trace.h"
+
+#define MAXTRACELINE (160)
+#define TRACEWRITESIZE (65536)			// Bytes per write, whole lines only
+#define BENCHPOINTS (10000000)			// Trace points per benchmark loop
+
+typedef struct {
+    int64_t time;						// ns, CLOCK_MONOTONIC
+    const char * name;
+    char phase;
+} TraceEvent_t;
+
+bool traceEnabled = false;
+
+static TraceEvent_t ring[TRACEEVENTS];
+static uint32_t head;					// Events recorded
+static uint32_t tail;					// Events dumped
+static uint32_t openPhases;				// Begins written without their end yet, ends may come in a later dump
+static uint32_t unmatched;				// Ends dropped because their begin was lost
+static int traceFd = -1;
+static pid_t tracePid;
+static char processName[32] = "master";
+
+static int64_t MonotonicNs ( void ) {
+    struct timespec now;
+
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return ( int64_t ) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+int TraceOpen ( const char * fileName ) {
+    sigset_t usr1;
+
+    traceFd = open ( fileName, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644 );
+    if ( ( traceFd == -1 ) || ( write ( traceFd, "[\n", 2 ) != 2 ) )
+        return -1;
+    sigemptyset ( &usr1 );
+    sigaddset ( &usr1, SIGUSR1 );
+    sigprocmask ( SIG_BLOCK, &usr1, NULL );
+    tracePid = getpid ();
+    traceEnabled = true;
+    return 0;
+}
+
+void TraceProcess ( const char * name ) {
+    head = 0;
+    tail = 0;
+    openPhases = 0;
+    unmatched = 0;
+    tracePid = getpid ();
+    snprintf ( processName, sizeof ( processName ), "%s", name );
+}
+
+void TraceRecord ( const char * name, char phase ) {
+    struct timespec now;
+    TraceEvent_t * e = &ring[head & ( TRACEEVENTS - 1 )];
+
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    e->time = ( int64_t ) now.tv_sec * 1000000000LL + now.tv_nsec;
+    e->name = name;
+    e->phase = phase;
+    head++;
+}
+
+bool TraceRequested ( void ) {
+    struct timespec zero = { 0, 0 };
+    sigset_t usr1;
+
+    if ( !traceEnabled )
+        return false;
+    sigemptyset ( &usr1 );
+    sigaddset ( &usr1, SIGUSR1 );
+    return sigtimedwait ( &usr1, NULL, &zero ) == SIGUSR1;
+}
+
+int TraceDump ( void ) {
+    static char out[TRACEWRITESIZE];
+    size_t len;
+    uint32_t dropped = 0;
+    int written = 0;
+    int64_t now;
+
+    if ( traceFd == -1 )
+        return 0;
+    if ( head - tail > TRACEEVENTS ) {
+        tail = head - TRACEEVENTS;				// Wrapped, the oldest are overwritten
+        openPhases = 0;							// Their begins may be among them
+    }
+
+    len = snprintf ( out, sizeof ( out ), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                     tracePid, tracePid, processName );
+    for ( ; tail != head; tail++ ) {
+        TraceEvent_t * e = &ring[tail & ( TRACEEVENTS - 1 )];
+
+        // An end whose begin was overwritten is dropped, the viewer would pair it with another begin
+        if ( e->phase == 'B' ) {
+            openPhases++;
+        } else if ( openPhases == 0 ) {
+            dropped++;
+            continue;
+        } else {
+            openPhases--;
+        }
+        len += snprintf ( out + len, sizeof ( out ) - len, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":%d},\n",
+                          e->name, e->phase, ( long long ) ( e->time / 1000 ), ( long long ) ( e->time % 1000 ), tracePid, tracePid );
+        written++;
+        if ( len > sizeof ( out ) - MAXTRACELINE ) {
+            if ( write ( traceFd, out, len ) != ( ssize_t ) len )
+                return -1;
+            len = 0;
+        }
+    }
+    if ( dropped > 0 ) {
+        unmatched += dropped;
+        now = MonotonicNs ();
+        len += snprintf ( out + len, sizeof ( out ) - len,
+                          "{\"name\":\"unmatched ends dropped\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%lld.%03lld,\"pid\":%d,\"tid\":%d,\"args\":{\"count\":%u}},\n",
+                          ( long long ) ( now / 1000 ), ( long long ) ( now % 1000 ), tracePid, tracePid, dropped );
+    }
+    if ( ( len > 0 ) && ( write ( traceFd, out, len ) != ( ssize_t ) len ) )
+        return -1;
+    return written;
+}
+
+uint32_t TraceUnmatched ( void ) {
+    return unmatched;
+}
+
+int TraceBench ( void ) {
+    bool enabled = traceEnabled;
+    uint32_t recorded = head;
+    int64_t start, empty, disabled, recording;
+
+    // The barrier stands for the code around a trace point, it keeps the flag load in the loop
+    start = MonotonicNs ();
+    for ( int i = 0; i < BENCHPOINTS; i++ ) {
+        __asm__ volatile ( "" ::: "memory" );
+    }
+    empty = MonotonicNs () - start;
+
+    traceEnabled = false;
+    start = MonotonicNs ();
+    for ( int i = 0; i < BENCHPOINTS; i++ ) {
+        TRACE_BEGIN ( "bench" );
+        __asm__ volatile ( "" ::: "memory" );
+    }
+    disabled = MonotonicNs () - start;
+
+    traceEnabled = true;
+    start = MonotonicNs ();
+    for ( int i = 0; i < BENCHPOINTS; i++ ) {
+        TRACE_BEGIN ( "bench" );
+        __asm__ volatile ( "" ::: "memory" );
+    }
+    recording = MonotonicNs () - start;
+
+    traceEnabled = enabled;
+    head = recorded;							// The benchmark events are not dumped
+    tail = recorded;
+    printf ( "Trace points: %d, loop: %.2f ns\n", BENCHPOINTS, ( double ) empty / BENCHPOINTS );
+    printf ( "Disabled: %.2f ns per trace point\n", ( double ) ( disabled - empty ) / BENCHPOINTS );
+    printf ( "Enabled: %.2f ns per trace point, ring of %d events\n", ( double ) ( recording - empty ) / BENCHPOINTS, TRACEEVENTS );
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * File:			Trace.h
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Event tracer, begin/end of the loop phases in Chrome trace format
+ *
+ * <MIT License>
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRACEEVENTS (8192)				// Ring buffer size per process, power of 2
+#define DEFAULTTRACEFILE "trace.json"
+
+extern bool traceEnabled;
+
+/*
+ * Phases are marked with TRACE_BEGIN ( "name" ) and TRACE_END ( "name" ), the name
+ * must be a string literal. Built without TRACE the marks compile to nothing, with
+ * TRACE but not enabled they cost one predictable branch.
+ */
+#ifdef TRACE
+#define TRACE_BEGIN(name) do { if ( __builtin_expect ( traceEnabled, 0 ) ) TraceRecord ( name, 'B' ); } while ( 0 )
+#define TRACE_END(name) do { if ( __builtin_expect ( traceEnabled, 0 ) ) TraceRecord ( name, 'E' ); } while ( 0 )
+#else
+#define TRACE_BEGIN(name) do { } while ( 0 )
+#define TRACE_END(name) do { } while ( 0 )
+#endif
+
+/**
+ * @brief   Enable tracing, called once by the master before the processes are started
+ *          Truncates the trace file and blocks SIGUSR1, a dump is requested by a
+ *          pending SIGUSR1 (see TraceRequested). The file is in JSON array format,
+ *          every process appends its events to it.
+ *
+ * @param   fileName    trace file
+ * @return  int         0 on success, -1 with errno set
+ */
+int TraceOpen ( const char * fileName );
+
+/**
+ * @brief   Start the trace of a new process, called after fork
+ *          Drops the events inherited from the parent.
+ *
+ * @param   name        process name shown in the trace viewer
+ */
+void TraceProcess ( const char * name );
+
+/**
+ * @brief   Record an event, use TRACE_BEGIN and TRACE_END instead
+ *
+ * @param   name        phase, string literal
+ * @param   phase       'B' begin or 'E' end
+ */
+void TraceRecord ( const char * name, char phase );
+
+/**
+ * @brief   Check for a dump request
+ *          Takes a pending SIGUSR1. The signal stays blocked, so it never
+ *          interrupts a transfer or a wait that is being traced.
+ *
+ * @return  bool        true if a dump was requested
+ */
+bool TraceRequested ( void );
+
+/**
+ * @brief   Append the buffered events of this process to the trace file and empty the buffer
+ *          The oldest events are lost if the buffer wrapped since the last dump. An end
+ *          whose begin was lost is dropped and counted, an instant event in the dump
+ *          shows how many.
+ *
+ * @return  int         number of events written, -1 on write error
+ */
+int TraceDump ( void );
+
+/**
+ * @brief   Ends dropped by the dumps of this process so far
+ *
+ * @return  uint32_t
+ */
+uint32_t TraceUnmatched ( void );
+
+/**
+ * @brief   Measure the cost of a trace point, disabled and recording into the ring
+ *          Prints the results, the recorded events are discarded.
+ *
+ * @return  int         0
+ */
+int TraceBench ( void );
+
+#endif
@@ -20,6 +20,8 @@
  *
  */
 
+#define _GNU_SOURCE				// ppoll
+
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -31,6 +33,7 @@
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <time.h>
+#include <poll.h>
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 
@@ -45,6 +48,17 @@
 #include <ctype.h>
 
 #include "ProcArgs.h"
+#include "Net.h"
+#include "Sample.h"
+#include "Stream.h"
+#include "Spool.h"
+#include "Collector.h"
+#include "Push.h"
+#include "Sensor.h"
+#include "Archive.h"
+#include "Rules.h"
+#include "Alarm.h"
+#include "Trace.h"
 
 //#ifndef DEBUG
 //#define DEBUG 1
@@ -54,29 +68,69 @@
 #define PS_ERROR (-1)
 #define PS_START (0)
 #define PS_MEASURING (1)
+#define PS_SUSPENDED (2)			// Circuit breaker open, sensor is not read
 
-#define MYPORT "4950"	// the port users will be connecting to
+#define DEFAULTDRAINTIMEOUT (2000)	// ms the children get to finish at shutdown
+#define STATUSTIMEOUT (200)			// ms to wait for status answers of all children
+#define COUNTERINTERVAL (60)		// s between logging the failure counters of the sensors
+#define READYPOLL (100)				// ms between data ready polls of a sensor without new data
+#define MAXGROUPSIZE (8)			// Sensors of a snapshot group, read by one process
+#define COMMANDMASK (0xFF)			// Low byte of a request is the command, the rest numbers the request
+#define MAXREPLYLENGTH (MAXGROUPSIZE * sizeof ( SensorCounters_t ))	// Longest reply of a child after its request
 
 // Constants
 const char *defaultMasterLogfileName = "sensormaster.log";
 const char *defaultMeasurementLogfileName = "measurement.txt";
+const char *defaultStoreFileName = "collected.txt";
 
 // Global variables
 volatile bool quitSignal = false;		// Quit signal, set by signal handler
-char serverAddress[MAXFILENAMELENGTH];
-int programMode = 0;					// 0 - Offline, 1 - Client, 2 - Server
+volatile bool termSignal = false;		// Terminate signal, shut down without asking
+volatile bool tickSignal = false;		// Timer tick, set by signal handler
+struct timespec termTime;				// Arrival of the terminate signal
+char serverAddress[MAXTARGETLISTLENGTH];
+char serverPort[MAXPORTLENGTH] = MYPORT;
+char boardListFileName[MAXFILENAMELENGTH];
+char storeFileName[MAXFILENAMELENGTH];
+int reorderWindow = DEFAULTREORDERWINDOW;
+char spoolDirName[MAXFILENAMELENGTH];
+int spoolBudget = DEFAULTSPOOLBUDGET;
+int catchupRate = DEFAULTCATCHUPRATE;
+int drainTimeout = DEFAULTDRAINTIMEOUT;
+char rulesFileName[MAXFILENAMELENGTH];
+char alarmLogFileName[MAXFILENAMELENGTH] = DEFAULTALARMLOG;
+char targetListFileName[MAXFILENAMELENGTH];
+int pushParallel = DEFAULTPUSHPARALLEL;
+int pushTimeout = DEFAULTPUSHTIMEOUT;
+char traceFileName[MAXFILENAMELENGTH];
+int programMode = 0;					// 0 - Offline, 1 - Client, 2 - Server, 3 - Collector, 4 - Trace benchmark
 struct timespec time_abs;
 struct itimerspec timer_struct;
 timer_t timerID;
 
+typedef struct {
+    uint32_t unsent;					// Samples the master did not take from the data socket
+    uint32_t unarchived;				// Samples that did not get into the archive file
+} SampleLoss_t;
+
+static RuleTable_t ruleTable;			// Alarm rules, each measuring process evaluates its own copy
+static int alarmSocket = -1;			// Events to the alarm dispatcher, -1 without rules
+static SampleLoss_t childLoss;			// Samples lost by this measuring process, reported when it exits
+static uint64_t unstreamedSamples;		// Samples no consumer got and no spool kept
+
 static void XsigHandler ( int sigNo ) {
     if ( sigNo == SIGINT ) {
         quitSignal = true;
     }
+    if ( ( sigNo == SIGTERM ) && !termSignal ) {
+        clock_gettime ( CLOCK_MONOTONIC, &termTime );				// Async-signal-safe
+        termSignal = true;
+    }
     return;
 }
 
 static void rt_handler ( int signo ) {
+    tickSignal = true;
     time_abs.tv_sec += 1;
     timer_struct.it_value = time_abs;
     timer_struct.it_interval.tv_sec = 0;
@@ -90,22 +144,16 @@ static void rt_handler ( int signo ) {
  *
  * @param sa		socket address structure
  * @param strIPaddr	string containing the result
+ * @param len		string buffer size
  * @return void*
  */
-void get_ip_addr ( struct sockaddr *sa, char * strIPaddr ) {
+void get_ip_addr ( struct sockaddr *sa, char * strIPaddr, size_t len ) {
 	uint32_t addrv4;
-	char * ptr = strIPaddr;
     if ( sa->sa_family == AF_INET ) {
 		addrv4 = ( ( struct sockaddr_in* ) sa )->sin_addr.s_addr;
-		snprintf(strIPaddr, 40, "%d.%d.%d.%d", addrv4 & 255, (addrv4 >> 8) & 255 , (addrv4 >> 16) & 255 , addrv4 >> 24 );
-    } else {
-	for (int i = 0; i < 8; i++) {
-		sprintf(ptr, "%x",  ( ( struct sockaddr_in6* ) sa )->sin6_addr.__in6_u.__u6_addr16[i] );
-		ptr +=4;
-		*ptr = ':';
-		ptr++;
-	}
-	*ptr = '\0';
+		snprintf(strIPaddr, len, "%d.%d.%d.%d", addrv4 & 255, (addrv4 >> 8) & 255 , (addrv4 >> 16) & 255 , addrv4 >> 24 );
+    } else if ( inet_ntop ( AF_INET6, &( ( struct sockaddr_in6* ) sa )->sin6_addr, strIPaddr, len ) == NULL ) {
+		snprintf(strIPaddr, len, "?");
 	}
 
 }
@@ -129,6 +177,410 @@ void getTimeStr( char * timeStr, size_t len) {
 	}
 }
 
+/**
+ * @brief Forward samples received from children to the stream consumers
+ *        Without consumers, or while older samples wait in the spool,
+ *        samples are spooled so the stream stays in order.
+ *
+ * @param dataSocket	master side data sockets of the children
+ * @param count			number of children
+ * @param stream		sample stream, NULL if not in server mode
+ * @param spool			spool, NULL if disabled
+ */
+static void ForwardSamples ( int dataSocket[][2], int count, Stream_t * stream, Spool_t * spool ) {
+    Sample_t sample;
+
+    for ( int i = 0; i < count; i++ ) {
+        while ( recv ( dataSocket[i][1], &sample, sizeof ( sample ), MSG_DONTWAIT ) == sizeof ( sample ) ) {
+            if ( stream == NULL ) {
+                continue;
+            }
+            if ( ( spool != NULL ) && ( ( stream->count == 0 ) || !SpoolEmpty ( spool ) ) ) {
+                SpoolPush ( spool, &sample );
+            } else if ( StreamSend ( stream, &sample ) == 0 ) {
+                if ( spool != NULL ) {
+                    SpoolPush ( spool, &sample );					// Consumer lost while sending
+                } else {
+                    unstreamedSamples++;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Replay spooled samples to the connected consumers
+ *        At most rate samples per call, so catching up does not starve live data.
+ *
+ * @param stream		sample stream
+ * @param spool			spool
+ * @param rate			samples to replay at most
+ * @return int			number of samples replayed
+ */
+static int ReplaySpool ( Stream_t * stream, Spool_t * spool, int rate ) {
+    Sample_t sample;
+    int replayed = 0;
+
+    while ( ( replayed < rate ) && ( StreamRoom ( stream ) > 0 ) && ( SpoolPeek ( spool, &sample ) == 0 ) ) {
+        if ( StreamSend ( stream, &sample ) == 0 ) {
+            break;
+        }
+        SpoolAdvance ( spool );
+        replayed++;
+    }
+    return replayed;
+}
+
+/**
+ * @brief Nanoseconds elapsed since a CLOCK_MONOTONIC time
+ *
+ * @param since		start time
+ * @return int64_t
+ */
+static int64_t ElapsedNs ( const struct timespec * since ) {
+    struct timespec now;
+
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return ( int64_t ) ( now.tv_sec - since->tv_sec ) * 1000000000LL + ( now.tv_nsec - since->tv_nsec );
+}
+
+/**
+ * @brief Write the failure counters of a sensor to a log file
+ *
+ * @param logFile		log file
+ * @param address		sensor address
+ * @param counters		failure counters
+ */
+static void LogCounters ( FILE * logFile, int address, const SensorCounters_t * counters ) {
+    char timestamp[40];
+
+    getTimeStr(timestamp, sizeof(timestamp));
+    fprintf ( logFile, "%s Sensor 0x%02x %s, readings: %u, failures: %u, retries: %u, timeouts: %u, crc errors: %u, not ready: %u, skipped: %u, suspended: %u times\n",
+              timestamp, address, SensorStateName ( counters->breakerState ), counters->readings, counters->failures,
+              counters->retries, counters->timeouts, counters->crcErrors, counters->notReady, counters->skipped, counters->trips );
+}
+
+/**
+ * @brief Answer a request of the master
+ *        The reply starts with the request, so the master can skip late
+ *        replies to earlier requests. It goes out in one write.
+ *
+ * @param fd			child side of the command channel
+ * @param request		request received
+ * @param reply			reply data
+ * @param length		reply length, at most MAXREPLYLENGTH
+ */
+static void SendReply ( int fd, int request, const void * reply, size_t length ) {
+    uint8_t out[sizeof ( int ) + MAXREPLYLENGTH];
+
+    memcpy ( out, &request, sizeof ( request ) );
+    memcpy ( out + sizeof ( request ), reply, length );
+    send ( fd, out, sizeof ( request ) + length, MSG_NOSIGNAL );			// The master may be gone at exit
+}
+
+/**
+ * @brief Length of the reply to a command, without the request
+ *
+ * @param command		command
+ * @param members		sensors read by the child
+ * @return size_t
+ */
+static size_t ReplyLength ( int command, int members ) {
+    switch ( command ) {
+    case 1:
+        return sizeof ( int );
+    case 2:
+        return members * sizeof ( SensorCounters_t );
+    case 4:
+        return sizeof ( SampleLoss_t );
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Wait for the reply of a child to a request
+ *        Replies to earlier requests, which arrived too late for their round,
+ *        are read and dropped.
+ *
+ * @param fd			master side of the command channel
+ * @param request		request sent
+ * @param reply			reply data
+ * @param members		sensors read by the child
+ * @param start			time the requests were sent
+ * @param timeoutMs		time the replies may take, counted from start
+ * @return int			0 on success, -1 if no reply arrived in time
+ */
+static int ReadReply ( int fd, int request, void * reply, int members, const struct timespec * start, int timeoutMs ) {
+    uint8_t late[MAXREPLYLENGTH];
+    struct pollfd replyPoll;
+    int answered;
+    int wait;
+    size_t length;
+
+    replyPoll.fd = fd;
+    replyPoll.events = POLLIN;
+    for ( ;; ) {
+        wait = timeoutMs - ( int ) ( ElapsedNs ( start ) / 1000000LL );
+        if ( poll ( &replyPoll, 1, ( wait > 0 ) ? wait : 0 ) <= 0 )
+            return -1;
+        if ( recv ( fd, &answered, sizeof ( answered ), MSG_WAITALL ) != sizeof ( answered ) )
+            return -1;
+        length = ReplyLength ( answered & COMMANDMASK, members );
+        if ( recv ( fd, ( answered == request ) ? reply : late, length, MSG_WAITALL ) != ( ssize_t ) length )
+            return -1;
+        if ( answered == request )
+            return 0;
+    }
+}
+
+/**
+ * @brief Check the alarm rules, then pass the sample to the master and to the
+ *        archive if the process writes one
+ *
+ * @param dataSocket	child side of the data socket
+ * @param sample		sample
+ * @param archive		archive, NULL if the values go to the measurement log
+ * @param measLog		measurement log file for archive errors
+ */
+static void SendSample ( int dataSocket, const Sample_t * sample, ArchiveWriter_t * archive, FILE * measLog ) {
+    char timestamp[40];
+    AlarmEvent_t events[MAXALARMEVENTS];
+    int count;
+
+    TRACE_BEGIN ( "send" );
+    if ( alarmSocket != -1 ) {
+        count = RulesEvaluate ( &ruleTable, sample, events, MAXALARMEVENTS );
+        for ( int i = 0; i < count; i++ ) {
+            events[i].evalTime = SampleTimeNow ();
+            if ( send ( alarmSocket, &events[i], sizeof ( events[i] ), MSG_DONTWAIT ) == -1 ) {
+                getTimeStr(timestamp, sizeof(timestamp));
+                fprintf ( measLog, "%s, %s, %s\n", timestamp, "alarm", strerror ( errno ) );
+            }
+        }
+    }
+    if ( send ( dataSocket, sample, sizeof ( *sample ), MSG_DONTWAIT ) == -1 ) {
+        childLoss.unsent++;
+    }
+    if ( ( archive != NULL ) && ( ArchiveAppend ( archive, sample ) == -1 ) ) {
+        childLoss.unarchived++;
+        getTimeStr(timestamp, sizeof(timestamp));
+        fprintf ( measLog, "%s, %s, %s\n", timestamp, "archive", strerror ( errno ) );
+    }
+    TRACE_END ( "send" );
+}
+
+/**
+ * @brief Read the sensors of a snapshot group and log one row
+ *        The values are read back-to-back after the common deadline, every
+ *        member once; failed members are retried after that pass, so their
+ *        backoff does not delay the others. Logging and sending only start
+ *        after the last transfer. All samples of the row share one timestamp.
+ *
+ * @param sensors		group members
+ * @param members		number of members
+ * @param measLog		measurement log file
+ * @param dataSocket	child side of the data socket
+ * @param archive		archive, NULL if the rows go to the measurement log
+ * @param seq			sample sequence number
+ * @param echo			echo the row to stdout
+ * @param skew			ns between the first and last value transfer of the first pass, -1 if less than two values were read
+ * @return int			process status
+ */
+static int ReadGroup ( Sensor_t * sensors, int members, FILE * measLog, int dataSocket, ArchiveWriter_t * archive,
+                       uint32_t * seq, bool echo, int64_t * skew ) {
+    char timestamp[40];
+    char row[64 + MAXGROUPSIZE * 16];
+    int rowLength;
+    int16_t values[MAXGROUPSIZE];
+    char units[MAXGROUPSIZE];
+    bool valid[MAXGROUPSIZE];
+    bool pending[MAXGROUPSIZE];
+    int errors[MAXGROUPSIZE];
+    int prevState[MAXGROUPSIZE];
+    uint32_t prevTrips[MAXGROUPSIZE];
+    char type;
+    int64_t first = 0, last = 0;
+    int readCount = 0;
+    int status = PS_MEASURING;
+    Sample_t sample;
+
+    TRACE_BEGIN ( "group read" );
+    sample.timestamp = SampleTimeNow ();
+    for ( int m = 0; m < members; m++ ) {
+        prevState[m] = sensors[m].breakerState;
+        prevTrips[m] = sensors[m].counters.trips;
+        valid[m] = false;
+        pending[m] = false;
+        errors[m] = 0;
+        if ( !SensorReady ( &sensors[m] ) ) {
+            if ( status == PS_MEASURING )
+                status = PS_SUSPENDED;
+        } else if ( SensorTryNTC ( &sensors[m], &values[m], &type, &units[m] ) == -1 ) {
+            pending[m] = true;									// Retried after the pass
+        } else {
+            valid[m] = true;
+            if ( ( readCount == 0 ) || ( sensors[m].sampledAt < first ) )
+                first = sensors[m].sampledAt;
+            if ( ( readCount == 0 ) || ( sensors[m].sampledAt > last ) )
+                last = sensors[m].sampledAt;
+            readCount++;
+        }
+    }
+    *skew = ( readCount > 1 ) ? last - first : -1;
+    TRACE_END ( "group read" );
+
+    // Retries of the failed members, outside of the snapshot
+    for ( int m = 0; m < members; m++ ) {
+        if ( !pending[m] )
+            continue;
+        TRACE_BEGIN ( "group retry" );
+        if ( SensorRetryNTC ( &sensors[m], &values[m], &type, &units[m] ) == -1 ) {
+            status = PS_ERROR;
+            errors[m] = errno;
+        } else {
+            valid[m] = true;
+        }
+        TRACE_END ( "group retry" );
+    }
+
+    // One row: value and unit of every member, "-" if not read, then the skew
+    TRACE_BEGIN ( "format" );
+    getTimeStr(timestamp, sizeof(timestamp));
+    rowLength = snprintf ( row, sizeof ( row ), "%s", timestamp );
+    for ( int m = 0; m < members; m++ ) {
+        if ( valid[m] ) {
+            rowLength += snprintf ( row + rowLength, sizeof ( row ) - rowLength, ", %d, %c", values[m], units[m] );
+        } else {
+            rowLength += snprintf ( row + rowLength, sizeof ( row ) - rowLength, ", -, -" );
+        }
+    }
+    if ( *skew >= 0 ) {
+        snprintf ( row + rowLength, sizeof ( row ) - rowLength, ", skew %lld us", ( long long ) ( *skew / 1000 ) );
+    }
+    TRACE_END ( "format" );
+    if ( archive == NULL ) {
+        TRACE_BEGIN ( "log write" );
+        fprintf ( measLog, "%s\n", row );
+        TRACE_END ( "log write" );
+    }
+    if ( echo ) {
+        printf ( "%s\n", row );
+    }
+
+    for ( int m = 0; m < members; m++ ) {
+        if ( valid[m] ) {
+            sample.seq = ( *seq )++;
+            sample.value = values[m];
+            sample.sensorAddress = ( uint16_t ) sensors[m].address;
+            sample.channel = 0;
+            sample.decimals = 0;
+            sample.unit = units[m];
+            SendSample ( dataSocket, &sample, archive, measLog );
+        } else if ( errors[m] != 0 ) {
+            fprintf ( measLog, "%s, %s 0x%02x, %s\n", timestamp, "i2c_read", sensors[m].address, strerror ( errors[m] ) );
+        }
+        // Circuit breaker changes
+        if ( sensors[m].counters.trips != prevTrips[m] ) {
+            fprintf ( measLog, "%s, sensor 0x%02x suspended, %d s\n", timestamp, sensors[m].address, sensors[m].cooldown );
+        } else if ( ( prevState[m] == BREAKER_OPEN ) && ( sensors[m].breakerState == BREAKER_CLOSED ) ) {
+            fprintf ( measLog, "%s, sensor 0x%02x resumed\n", timestamp, sensors[m].address );
+        }
+    }
+    return status;
+}
+
+/**
+ * @brief Write the exit status of a child process to the log file
+ *
+ * @param logFile		log file
+ * @param pid			process ID
+ * @param exitStatus	status returned by wait
+ */
+static void LogExitStatus ( FILE * logFile, pid_t pid, int exitStatus ) {
+    char timestamp[40];
+
+    getTimeStr(timestamp, sizeof(timestamp));
+    if ( WIFEXITED ( exitStatus ) ) {
+        fprintf ( logFile, "%s Process %d terminated normally with code: %d\n", timestamp, pid, WEXITSTATUS ( exitStatus ) );
+    }
+    if ( WIFSIGNALED ( exitStatus ) ) {
+        fprintf ( logFile, "%s Process %d terminated abnormally by signal: %d\n", timestamp, pid, WTERMSIG ( exitStatus ) );
+    }
+}
+
+/**
+ * @brief Stop all children within the drain deadline
+ *        Children finish their measurement in progress, flush their log and exit.
+ *        Samples keep being forwarded while waiting. Children still running
+ *        at the deadline are killed.
+ *
+ * @param processes		process IDs
+ * @param processSocket	command channels
+ * @param dataSocket	data channels
+ * @param count			number of children
+ * @param members		sensors read by each child
+ * @param readingSamples	samples of one reading of each child, lost if it is killed
+ * @param drainMs		deadline in milliseconds
+ * @param stream		sample stream, NULL if not in server mode
+ * @param spool			spool, NULL if disabled
+ * @param logFile		master log file
+ * @param loss			samples lost by the children, reported by them or counted for the killed ones
+ * @return int			number of children killed
+ */
+static int ShutdownChildren ( pid_t processes[], int processSocket[][2], int dataSocket[][2], int count, const int members[],
+                              const int readingSamples[], int drainMs, Stream_t * stream, Spool_t * spool, FILE * logFile,
+                              SampleLoss_t * loss ) {
+    bool exited[MAXPROCESSES] = { false };
+    SampleLoss_t reported;
+    struct timespec start;
+    struct timespec pause = { 0, 1000000 };				// 1 ms between checks
+    int remaining = count;
+    int killed = 0;
+    int msg = 4;
+    int exitStatus;
+
+    clock_gettime ( CLOCK_MONOTONIC, &start );
+
+    // Send terminate signal to chidren
+    for ( int i = 0; i < count; i++ ) {
+        send ( processSocket[i][1], &msg, sizeof ( msg ), MSG_DONTWAIT | MSG_NOSIGNAL );
+    }
+
+    // Only the measuring processes, the alarm dispatcher is stopped after them
+    while ( ( remaining > 0 ) && ( ElapsedNs ( &start ) < ( int64_t ) drainMs * 1000000LL ) ) {
+        for ( int i = 0; i < count; i++ ) {
+            if ( !exited[i] && ( waitpid ( processes[i], &exitStatus, WNOHANG ) == processes[i] ) ) {
+                exited[i] = true;
+                remaining--;
+                LogExitStatus ( logFile, processes[i], exitStatus );
+                // The final reply is already in the channel
+                if ( ReadReply ( processSocket[i][1], 4, &reported, members[i], &start, drainMs ) == 0 ) {
+                    loss->unsent += reported.unsent;
+                    loss->unarchived += reported.unarchived;
+                }
+            }
+        }
+        if ( remaining == 0 )
+            break;
+        ForwardSamples ( dataSocket, count, stream, spool );
+        nanosleep ( &pause, NULL );
+    }
+
+    // Deadline passed
+    for ( int i = 0; i < count; i++ ) {
+        if ( !exited[i] ) {
+            kill ( processes[i], SIGKILL );
+            waitpid ( processes[i], &exitStatus, 0 );
+            LogExitStatus ( logFile, processes[i], exitStatus );
+            loss->unsent += readingSamples[i];							// The reading in progress
+            killed++;
+        }
+    }
+    ForwardSamples ( dataSocket, count, stream, spool );
+    return killed;
+}
+
 /**
  * @brief main function
  *
@@ -142,22 +594,44 @@ int main ( int argc, char *argv[] ) {
     int exitStatus;
     ProcessArguments_t procArgs[MAXPROCESSES];	// Process arguments
     int processSocket[MAXPROCESSES][2];			// Communication channel between process and master
+    int killedProcesses = 0;
+    struct timespec shutdownStart;
+    struct timespec statusStart;
+    int request;								// Command sent to the children, numbered
+    int loopCount = 0;
+    SensorCounters_t counters[MAXGROUPSIZE];
+    int dataSocket[MAXPROCESSES][2];			// Measurement samples from process to master
+    Sample_t sample;
+    Spool_t spool;								// Store-and-forward queue for the sample stream
+    bool spoolEnabled = false;
+    bool spoolReplaying = false;
+    pid_t alarmDispatcher = -1;
 
     //////////////////////////////////////// Master process variables
     char masterLogfileName[MAXFILENAMELENGTH];
     FILE * masterLogfile;
     int configuredProcesses = 0;
     int runningProcesses = 0;
+    int startedArgs = 0;						// Process arguments taken by running processes
+    int processFirstArg[MAXPROCESSES];			// Arguments of the first sensor of each process
+    int processMembers[MAXPROCESSES];			// Sensors read by each process, more than one for a snapshot group
+    int processSamples[MAXPROCESSES];			// Samples of one reading of each process, every member and channel
+    struct pollfd dataPoll[MAXPROCESSES];		// Data sockets, waited on between the ticks
+    SampleLoss_t lostSamples = { 0, 0 };		// Reported by the measuring processes at shutdown
+    uint64_t spoolDropped = 0;
+    uint64_t lostTotal;
+    int members;
+    ProcessArguments_t groupArgs;
     int msg;									// Command to send for processes
     char statusMsg[10];							// Status report from process
     char timestamp[40];							// Time stamp
-	char strIPAddr[40];							// Holds the IP address in string format
+	char strIPAddr[INET6_ADDRSTRLEN];							// Holds the IP address in string format
 
     //////////////////////////////////////// Control variables
     bool exitSignal = false;
 
     //////////////////////////////////////// Signal handling variables
-    struct sigaction Xhandler, oldHandler;
+    struct sigaction Xhandler, oldHandler, oldTermHandler;
     sigset_t XSignalBlock;
     struct sigaction sigAct;
     sigset_t sigmask, timermask;
@@ -165,7 +639,8 @@ int main ( int argc, char *argv[] ) {
 
     // Socket handling variables
     int serverSocket, server2ClientSocket;		// Sockets for server side handling
-    int client2ServerSocket;					// Socket for client side handling
+    Stream_t sampleStream;						// Sample stream to remote consumers
+    char streamPort[MAXPORTLENGTH];
     struct sockaddr srvAddrStruct, clientAddrStruct;
     int file_flags;
     struct addrinfo hints, *servinfo, *p;
@@ -184,10 +659,27 @@ int main ( int argc, char *argv[] ) {
         printf ( "Usage:\n" );											// Print usage and terminate
         printf ( "%s -h\n", argv[0] );
         printf ( "%s -c [-l <master_logfile>] [-a <address> | -s] [-mfile <filename>] -sensortype <NTC|SCC30> -sensoraddress <address> [-echo {off|on} -interval <t>]\n", argv[0] );
-        printf ( "%s -f <inputfile_containing_command> [-l <master_logfile>] [-a <address> | -s]\n", argv[0] );
+        printf ( "%s -f <inputfile_containing_command> [-l <master_logfile>] [-a <address> | -s] [-targets <file>]\n", argv[0] );
+        printf ( "%s -collect <boardlist> [-store <file>] [-window <ms>] [-l <master_logfile>]\n", argv[0] );
+        printf ( "%s -tracebench\n", argv[0] );
         printf ( "-l <master_logfile> is optional. If not specified the default name is: %s\n", defaultMasterLogfileName );
         printf ( "-a <address> is optional. If specified the commands are sent to program running at <address>.\n" );
+        printf ( "   <address> may be a comma separated list of host[:port], -targets <file> adds one host[:port] per line.\n" );
+        printf ( "   The targets get the commands at once, -parallel <n> connections (default: %d), -pushtimeout <ms> each (default: %d)\n",
+                 DEFAULTPUSHPARALLEL, DEFAULTPUSHTIMEOUT );
         printf ( "-s is optional. If specified the program listening on network for commands.\n" );
+        printf ( "   Measurements are streamed to consumers connecting to port + 1.\n" );
+        printf ( "   -spool <dir> keeps measurements on disk while no consumer is connected (at most -spoolsize <MB>, default: %d)\n", DEFAULTSPOOLBUDGET );
+        printf ( "   and replays them at -catchup <samples/s> (default: %d) when a consumer connects.\n", DEFAULTCATCHUPRATE );
+        printf ( "SIGTERM, or SIGINT without a terminal, stops the program without asking.\n" );
+        printf ( "-drain <ms> is optional. Time the processes get to finish at shutdown, default: %d\n", DEFAULTDRAINTIMEOUT );
+        printf ( "-rules <file> is optional. Alarm rules checked on every sample, alarms are logged to -alarmlog <file> (default: %s)\n", DEFAULTALARMLOG );
+        printf ( "-trace <file> is optional. Records the phases of the processes, SIGUSR1 appends them to <file> in Chrome trace format.\n" );
+        printf ( "-tracebench measures the cost of a trace point, disabled and enabled, and exits.\n" );
+        printf ( "-p <port> is optional. Command port for -a, -s and -collect, default: %s\n", MYPORT );
+        printf ( "-collect <boardlist> merges the measurement streams of the servers listed in <boardlist>,\n" );
+        printf ( "   one \"host[:port]\" per line, into -store <file> (default: %s).\n", defaultStoreFileName );
+        printf ( "   -window <ms> is the longest wait for a silent board before merging past it, default: %d\n", DEFAULTREORDERWINDOW );
         printf ( "If neither -a or -s specified program works offline.\n" );
         printf ( "The format of inputfile is the same as in '-c' mode. One command per line. If the first character of line is '#' the line is ignored.\n" );
         printf ( "Sensor address format is hexadecimal with '0x' prefix, ie. 0xA8.\n" );
@@ -201,10 +693,11 @@ int main ( int argc, char *argv[] ) {
     // Set up signal handler
     sigemptyset ( &XSignalBlock );
     sigaddset ( &XSignalBlock, SIGINT );
+    sigaddset ( &XSignalBlock, SIGTERM );
     Xhandler.sa_handler = XsigHandler;
     Xhandler.sa_mask = XSignalBlock;
     Xhandler.sa_flags = 0;
-    if ( sigaction ( SIGINT, &Xhandler, &oldHandler ) < 0 ) {
+    if ( ( sigaction ( SIGINT, &Xhandler, &oldHandler ) < 0 ) || ( sigaction ( SIGTERM, &Xhandler, &oldTermHandler ) < 0 ) ) {
         perror ( "Signal" );
 		getTimeStr(timestamp, sizeof(timestamp));
         fprintf ( masterLogfile, "%s, %s, %s\n", timestamp, "Signal", strerror ( errno ) );
@@ -224,78 +717,97 @@ int main ( int argc, char *argv[] ) {
     tmrEvent.sigev_value.sival_int = 12;
     timer_create ( CLOCK_REALTIME, &tmrEvent, &timerID );
 
+    sigaddset ( &XSignalBlock, SIGRTMAX );							// Blocked in the main loop, only taken while waiting
     sigfillset ( &timermask );										// used by sigsuspend at the end of main loop
     sigdelset ( &timermask, SIGRTMAX );
+    sigdelset ( &timermask, SIGINT );								// Do not delay quitting until the next timer
+    sigdelset ( &timermask, SIGTERM );
 
 #ifdef DEBUG
     printf ( "Process count: %d\n", configuredProcesses );
     printf ( "Server address: %s\n", serverAddress );
 #endif
 
+	//////////////////////////////////////// Program in collector mode
+	//////////////////////////////////////// Merges sample streams of servers until SIGINT or SIGTERM
+
+    if ( programMode == 3 ) {
+        exitStatus = RunCollector ( boardListFileName, storeFileName, reorderWindow, masterLogfile );
+        fclose ( masterLogfile );
+        sigaction ( SIGINT, &oldHandler, NULL );						// Restore old signal handler
+        exit ( exitStatus );
+    }
+
+	//////////////////////////////////////// Trace point benchmark
+
+    if ( programMode == 4 ) {
+#ifdef TRACE
+        exitStatus = TraceBench ();
+#else
+        printf ( "Built without TRACE, trace points compile to nothing.\n" );
+        exitStatus = EXIT_SUCCESS;
+#endif
+        fclose ( masterLogfile );
+        sigaction ( SIGINT, &oldHandler, NULL );						// Restore old signal handler
+        exit ( exitStatus );
+    }
+
 	//////////////////////////////////////// Program in client mode
 	//////////////////////////////////////// Sends commands to server and terminates
 
     // Check if client mode...
-    // ...and open socket to address, send data and terminate.
+    // ...and send the commands to every target, then terminate.
     if ( programMode == 1 ) {
-		memset(&hints, 0, sizeof(struct addrinfo));
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_flags = 0;
-		hints.ai_protocol = 0;
-
-		if ((rv = getaddrinfo(serverAddress, MYPORT, &hints, &servinfo)) != 0) {
-			printf("getaddrinfo: %s\n", gai_strerror(rv));
-			getTimeStr(timestamp, sizeof(timestamp));
-            fprintf ( masterLogfile, "%s, %s, %s\n", timestamp, "clientsocket", gai_strerror(rv) );
+        exitStatus = PushCommands ( serverAddress, targetListFileName, procArgs, configuredProcesses, pushParallel, pushTimeout,
+                                    masterLogfile );
+        fclose ( masterLogfile );
+        sigaction ( SIGINT, &oldHandler, NULL );						// Restore old signal handler
+        exit ( exitStatus );
+    }
+
+	//////////////////////////////////////// Event trace
+
+    if ( traceFileName[0] != '\0' ) {
+#ifdef TRACE
+        if ( TraceOpen ( traceFileName ) == -1 ) {
+            perror ( traceFileName );
+            getTimeStr(timestamp, sizeof(timestamp));
+            fprintf ( masterLogfile, "%s, %s, %s\n", timestamp, traceFileName, strerror ( errno ) );
             fclose ( masterLogfile );
-            sigaction ( SIGINT, &oldHandler, NULL );						// Restore old signal handler
             exit ( EXIT_FAILURE );
-			return 1;
-		}
-
-#ifdef DEBUG
-        printf("getaddrinfo returned:\n");
-		for ( p = servinfo; p != NULL; p = p->ai_next ) {
-			get_ip_addr(p->ai_addr, strIPAddr);
-			printf("flags: %d\tfamily:%d\tsocktype:%d\tprotocol:%d\taddr:%s\tcanonname:%s\n",
-//					p->ai_flags, p->ai_family, p->ai_socktype, p->ai_protocol, p->ai_addr->sa_data , p->ai_canonname);
-					p->ai_flags, p->ai_family, p->ai_socktype, p->ai_protocol, strIPAddr , p->ai_canonname);
-		}
-		printf("End of listing\n");
+        }
+        printf ( "Tracing to %s, SIGUSR1 writes the events.\n", traceFileName );
+#else
+        printf ( "Built without TRACE, -trace parameter is ignored.\n" );
 #endif
+    }
 
-		// loop through all the results and make a socket
-		for(p = servinfo; p != NULL; p = p->ai_next) {
-			if ((client2ServerSocket = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1) {
-				perror("clientsocket");
-				continue;
-			}
-			if (connect(client2ServerSocket, p->ai_addr, p->ai_addrlen) != -1)
-				break;
-			close(client2ServerSocket);
-		}
+	//////////////////////////////////////// Alarm rules
+	//////////////////////////////////////// Dispatcher starts before any network socket is open
+
+    if ( rulesFileName[0] != '\0' ) {
+        int eventSocket[2];
 
-		if (p == NULL) {
-			printf("Connection failed\n");
+        if ( RulesLoad ( &ruleTable, rulesFileName ) == -1 ) {
             getTimeStr(timestamp, sizeof(timestamp));
-            fprintf ( masterLogfile, "%s, %s\n", timestamp, "Connection failed" );
+            fprintf ( masterLogfile, "%s, %s, %s\n", timestamp, rulesFileName, "Invalid rules file" );
             fclose ( masterLogfile );
-            sigaction ( SIGINT, &oldHandler, NULL );						// Restore old signal handler
             exit ( EXIT_FAILURE );
-		}
-
-        for ( int i = 0; i < configuredProcesses; i++ ) {
-            write ( client2ServerSocket, &procArgs[i], sizeof ( procArgs[i] ) );
         }
-
+        fflush ( NULL );
+        if ( ( socketpair ( AF_UNIX, SOCK_DGRAM, 0, eventSocket ) == -1 )
+                || ( ( alarmDispatcher = AlarmStart ( &ruleTable, alarmLogFileName, eventSocket ) ) == -1 ) ) {
+            perror ( "Alarm dispatcher" );
+            getTimeStr(timestamp, sizeof(timestamp));
+            fprintf ( masterLogfile, "%s, %s, %s\n", timestamp, "Alarm dispatcher", strerror ( errno ) );
+            fclose ( masterLogfile );
+            exit ( EXIT_FAILURE );
+        }
+        close ( eventSocket[1] );
+        alarmSocket = eventSocket[0];
         getTimeStr(timestamp, sizeof(timestamp));
-        fprintf ( masterLogfile, "%s, %s\n", timestamp, "Command send successful" );
-        fclose ( masterLogfile );
-        close ( client2ServerSocket );
-		freeaddrinfo(servinfo);
-        sigaction ( SIGINT, &oldHandler, NULL );						// Restore old signal handler
-        exit ( EXIT_SUCCESS );
+        fprintf ( masterLogfile, "%s Rules loaded: %d, alarm log: %s, dispatcher: %d\n", timestamp, ruleTable.count,
+                  alarmLogFileName, alarmDispatcher );
     }
 
 	//////////////////////////////////////// Program in server mode
@@ -312,7 +824,7 @@ int main ( int argc, char *argv[] ) {
 		hints.ai_addr = NULL;
 		hints.ai_next = NULL;
 
-        if ( ( rv = getaddrinfo ( NULL, MYPORT, &hints, &servinfo ) ) != 0 ) {
+        if ( ( rv = getaddrinfo ( NULL, serverPort, &hints, &servinfo ) ) != 0 ) {
             printf ( "getaddrinfo: %s\n", gai_strerror ( rv ) );
             getTimeStr(timestamp, sizeof(timestamp));
             fprintf ( masterLogfile, "%s, %s, %s\n", timestamp, "getaddrinfo", gai_strerror ( rv ) );
@@ -373,9 +885,37 @@ int main ( int argc, char *argv[] ) {
 
         addressStructSize = sizeof(srvAddrStruct);
         getsockname(serverSocket, &srvAddrStruct, &addressStructSize);
-		get_ip_addr(&srvAddrStruct, strIPAddr);
+		get_ip_addr(&srvAddrStruct, strIPAddr, sizeof(strIPAddr));
 		printf("Server listening on address: %s\n", strIPAddr );
-		printf("Port number: %s\n", MYPORT );
+		printf("Port number: %s\n", serverPort );
+
+        // Sample stream for remote consumers
+        NetStreamPort ( serverPort, streamPort );
+        if ( StreamOpen ( &sampleStream, streamPort ) == -1 ) {
+            perror ( "streamlisten" );
+            getTimeStr(timestamp, sizeof(timestamp));
+            fprintf ( masterLogfile, "%s, %s, %s\n", timestamp, "streamlisten", strerror ( errno ) );
+            fclose ( masterLogfile );
+            close ( serverSocket );
+            sigaction ( SIGINT, &oldHandler, NULL );						// Restore old signal handler
+            exit ( EXIT_FAILURE );
+        }
+		printf("Sample stream port number: %s\n", streamPort );
+
+        if ( spoolDirName[0] != '\0' ) {
+            if ( SpoolOpen ( &spool, spoolDirName, spoolBudget ) == -1 ) {
+                perror ( "spool" );
+                getTimeStr(timestamp, sizeof(timestamp));
+                fprintf ( masterLogfile, "%s, %s, %s\n", timestamp, "spool", strerror ( errno ) );
+                fclose ( masterLogfile );
+                StreamClose ( &sampleStream );
+                close ( serverSocket );
+                sigaction ( SIGINT, &oldHandler, NULL );						// Restore old signal handler
+                exit ( EXIT_FAILURE );
+            }
+            spoolEnabled = true;
+            printf ( "Spool directory: %s, %llu samples to replay\n", spoolDirName, ( unsigned long long ) spool.queued );
+        }
     }
 
 	//////////////////////////////////////// Set up timer
@@ -388,6 +928,9 @@ int main ( int argc, char *argv[] ) {
     timer_struct.it_interval.tv_nsec = 0;
     timer_settime ( timerID, TIMER_ABSTIME, &timer_struct, NULL );
 
+    // A signal arriving between the quit check and sigsuspend would only be seen after the next tick
+    sigprocmask ( SIG_BLOCK, &XSignalBlock, NULL );
+
 #ifdef DEBUG
     printf ( "Init complete!\n" );
 #endif
@@ -398,7 +941,27 @@ int main ( int argc, char *argv[] ) {
 
 		//////////////////////////////////////// Start new processes
 
-        if ( configuredProcesses > runningProcesses ) {
+        if ( configuredProcesses > startedArgs ) {
+            TRACE_BEGIN ( "spawn" );
+            // Sensors of a snapshot group share one process, their arguments are moved next to each other.
+            // An SCD30 measures on its own clock, it is not grouped.
+            members = 1;
+            if ( ( procArgs[startedArgs].group > 0 ) && ( strcmp ( procArgs[startedArgs].sensorType, "SCC" ) != 0 ) ) {
+                for ( int i = startedArgs + 1; ( i < configuredProcesses ) && ( members < MAXGROUPSIZE ); i++ ) {
+                    if ( ( procArgs[i].group == procArgs[startedArgs].group ) && ( strcmp ( procArgs[i].sensorType, "SCC" ) != 0 ) ) {
+                        groupArgs = procArgs[startedArgs + members];
+                        procArgs[startedArgs + members] = procArgs[i];
+                        procArgs[i] = groupArgs;
+                        members++;
+                    }
+                }
+                getTimeStr(timestamp, sizeof(timestamp));
+                fprintf ( masterLogfile, "%s, Snapshot group %d, sensors: %d\n", timestamp, procArgs[startedArgs].group, members );
+            }
+            processFirstArg[runningProcesses] = startedArgs;
+            processMembers[runningProcesses] = members;
+            processSamples[runningProcesses] = ( strcmp ( procArgs[startedArgs].sensorType, "SCC" ) == 0 ) ? SCD30CHANNELS : members;
+
             // Start new process from process arguments
             if ( socketpair ( AF_UNIX, SOCK_STREAM, 0, processSocket[runningProcesses] ) == -1 ) {
                 perror ( "socketpair" );
@@ -409,93 +972,298 @@ int main ( int argc, char *argv[] ) {
                 sigaction ( SIGINT, &oldHandler, NULL );						// Restore old signal handler
                 exit ( EXIT_FAILURE );
             }
+            // Datagrams keep the sample boundaries
+            if ( socketpair ( AF_UNIX, SOCK_DGRAM, 0, dataSocket[runningProcesses] ) == -1 ) {
+                perror ( "socketpair" );
+                getTimeStr(timestamp, sizeof(timestamp));
+                fprintf ( masterLogfile, "%s, %s, %s\n", timestamp, "socketpair", strerror ( errno ) );
+                fclose ( masterLogfile );
+                close ( serverSocket );
+                sigaction ( SIGINT, &oldHandler, NULL );						// Restore old signal handler
+                exit ( EXIT_FAILURE );
+            }
 
             //////////////////////////////////////// Child process starts
 
+            fflush ( NULL );										// The child would write buffered lines again
             processes[runningProcesses] = fork();
             if ( processes[runningProcesses] == 0 ) {				// Child process
-                bool echo = procArgs[runningProcesses].echo;
-                int measInterval = procArgs[runningProcesses].interval;
-                int counter = 0;
+                ProcessArguments_t * memberArgs = &procArgs[processFirstArg[runningProcesses]];
+                int members = processMembers[runningProcesses];
+                bool echo = memberArgs[0].echo;
+                int measInterval = memberArgs[0].interval;
+                struct timespec nextSample, now, timeout;
+                struct pollfd commandPoll;
+                sigset_t childBlock, childWaitMask;
+                struct sigaction childIgnore;
                 FILE *measLog;
                 int16_t meas = 0;
+                uint32_t seq = 0;
                 char unit = '\0';
                 char senstype = '\0';
-                int sensorFD;
-				char reg;
+                int32_t values[SCD30CHANNELS];
+                char valueStr[SCD30CHANNELS][16];
+                static const char channelUnits[SCD30CHANNELS] = { 'p', 'C', '%' };
+                int readResult;
+                bool pollAgain, wasStarted;
+                Sensor_t sensors[MAXGROUPSIZE];
+                Sensor_t * sensor = &sensors[0];
+                int64_t skew, skewMax = 0, skewSum = 0;
+                uint32_t snapshots = 0;
+                static ArchiveWriter_t archiveWriter;
+                ArchiveWriter_t * archive = NULL;
+                int prevState;
+                uint32_t prevTrips;
 
                 bool childTerminate = false;
                 int childStatus = PS_START;
 
-                measLog = fopen ( procArgs[runningProcesses].filename, "a+" );
+                // SIGINT is the master's business, SIGTERM is only taken while waiting,
+                // so a measurement in progress is always finished
+                childIgnore.sa_handler = SIG_IGN;
+                sigemptyset ( &childIgnore.sa_mask );
+                childIgnore.sa_flags = 0;
+                sigaction ( SIGINT, &childIgnore, NULL );
+                sigemptyset ( &childBlock );
+                sigaddset ( &childBlock, SIGTERM );
+                sigprocmask ( SIG_BLOCK, &childBlock, &childWaitMask );
+                sigdelset ( &childWaitMask, SIGTERM );
+
+                if ( members > 1 ) {
+                    snprintf ( timestamp, sizeof ( timestamp ), "group %d", memberArgs[0].group );
+                } else {
+                    snprintf ( timestamp, sizeof ( timestamp ), "sensor 0x%02x", memberArgs[0].sensorAddress );
+                }
+                TraceProcess ( timestamp );
+
+                measLog = fopen ( memberArgs[0].filename, "a+" );
+                setvbuf ( measLog, NULL, _IOLBF, 0 );						// A killed child loses no logged line
 
                 close ( processSocket[runningProcesses][1] );				// Child close socket side 1
+                close ( dataSocket[runningProcesses][1] );
+                if ( programMode == 2 ) {									// Network and spool belong to the master
+                    close ( serverSocket );
+                    close ( sampleStream.listener );
+                    for ( int i = 0; i < sampleStream.count; i++ ) {
+                        close ( sampleStream.consumers[i].fd );
+                    }
+                }
+                if ( spoolEnabled ) {
+                    close ( spool.readFd );
+                    close ( spool.writeFd );
+                }
+
+                // Values go to the archive instead of the measurement log, events stay in the log
+                if ( memberArgs[0].archive[0] != '\0' ) {
+                    if ( ArchiveOpen ( &archiveWriter, memberArgs[0].archive ) == 0 ) {
+                        archive = &archiveWriter;
+                    } else {
+                        perror ( "archive" );
+                        getTimeStr(timestamp, sizeof(timestamp));
+                        fprintf ( measLog, "%s, %s, %s\n", timestamp, "archive", strerror ( errno ) );
+                    }
+                }
 
-				if (strcmp(procArgs[runningProcesses].sensorType, "NTC") == 0) {
-					// Init NTC sensor
-					sensorFD = open("/dev/i2c-2", O_RDWR);
-					if (sensorFD == -1) {
-						perror("i2c_open");
-						getTimeStr(timestamp, sizeof(timestamp));
-						fprintf ( measLog, "%s, %s, %s\n", timestamp, "i2c_open", strerror ( errno ) );
-					}
-					if (ioctl(sensorFD, I2C_SLAVE, procArgs[runningProcesses].sensorAddress) == -1) {
-						perror("i2c_ioctl");
-						getTimeStr(timestamp, sizeof(timestamp));
-						fprintf ( measLog, "%s, %s, %s\n", timestamp, "i2c_ioctl", strerror ( errno ) );
-					}
-				}
+                // Init sensors, a failed open is retried by the readings
+                for ( int m = 0; m < members; m++ ) {
+                    if ( SensorInit ( &sensors[m], &memberArgs[m] ) == -1 ) {
+                        perror ( "i2c_open" );
+                        getTimeStr(timestamp, sizeof(timestamp));
+                        fprintf ( measLog, "%s, %s, %s\n", timestamp, "i2c_open", strerror ( errno ) );
+                    }
+                }
+                if ( sensor->type == SENSOR_SCD30 ) {
+                    measInterval = sensor->interval;							// Not faster than the sensor measures
+                }
 
                 childStatus = PS_MEASURING;
+                clock_gettime ( CLOCK_MONOTONIC, &nextSample );
+                nextSample.tv_sec += measInterval;
                 while ( !childTerminate ) {
-                    if ( measInterval == counter ) {
-                        // Take measurement
-						// Read value
-						reg = 1;
-						write(sensorFD, &reg, 1);
-						if (read(sensorFD, &meas, 2) <= 0) {
-							childStatus = PS_ERROR;
-						} else {
-							childStatus = PS_MEASURING;
-						}
-						meas = (meas >> 8) | (meas << 8);			// Swap byte order
-						// Read type
-						reg = 2;
-						write(sensorFD, &reg, 1);
-						read(sensorFD, &senstype, 1);
-						// Read unit
-						reg = 3;
-						write(sensorFD, &reg, 1);
-						read(sensorFD, &unit, 1);
-                        getTimeStr(timestamp, sizeof(timestamp));
-                        // Log measurement
-                        fprintf ( measLog, "%s, %d, %c\n", timestamp, meas, unit );
-                        if ( echo ) {
-//                             printf ( "%s, Type: %c Value: %d, %x Unit: %c, %x\n", ctime ( &currentTime.tv_sec ), senstype, meas, meas, unit, unit );
-							printf ( "%s, Value: %d\tUnit: %c\n", timestamp, meas, unit );
+                    clock_gettime ( CLOCK_MONOTONIC, &now );
+                    if ( ( now.tv_sec > nextSample.tv_sec )
+                            || ( ( now.tv_sec == nextSample.tv_sec ) && ( now.tv_nsec >= nextSample.tv_nsec ) ) ) {
+                        if ( members > 1 ) {
+                            // Snapshot of the whole group
+                            childStatus = ReadGroup ( sensors, members, measLog, dataSocket[runningProcesses][0], archive,
+                                                      &seq, echo, &skew );
+                            if ( skew >= 0 ) {
+                                snapshots++;
+                                skewSum += skew;
+                                if ( skew > skewMax ) {
+                                    skewMax = skew;
+                                }
+                            }
+                            do {
+                                nextSample.tv_sec += measInterval;
+                            } while ( nextSample.tv_sec <= now.tv_sec );
+                            continue;
+                        }
+                        // Take measurement, unless the sensor is suspended
+                        prevState = sensor->breakerState;
+                        prevTrips = sensor->counters.trips;
+                        pollAgain = false;
+                        if ( !SensorReady ( sensor ) ) {
+                            childStatus = PS_SUSPENDED;
+                        } else if ( sensor->type == SENSOR_SCD30 ) {
+                            wasStarted = sensor->started;
+                            readResult = SensorReadSCD30 ( sensor, values );
+                            if ( readResult == -1 ) {
+                                childStatus = PS_ERROR;
+                                getTimeStr(timestamp, sizeof(timestamp));
+                                fprintf ( measLog, "%s, %s, %s\n", timestamp, "i2c_read", strerror ( errno ) );
+                            } else if ( readResult == 1 ) {
+                                childStatus = PS_MEASURING;
+                                pollAgain = wasStarted;							// No new data yet, unless just started
+                            } else {
+                                childStatus = PS_MEASURING;
+                                getTimeStr(timestamp, sizeof(timestamp));
+                                sample.timestamp = SampleTimeNow ();
+                                sample.sensorAddress = memberArgs[0].sensorAddress;
+                                sample.decimals = SCD30DECIMALS;
+                                // Pass the channels to master, all with the same timestamp
+                                for ( int i = 0; i < SCD30CHANNELS; i++ ) {
+                                    sample.seq = seq++;
+                                    sample.value = values[i];
+                                    sample.channel = ( uint8_t ) i;
+                                    sample.unit = channelUnits[i];
+                                    SampleFormatValue ( &sample, valueStr[i], sizeof ( valueStr[i] ) );
+                                    SendSample ( dataSocket[runningProcesses][0], &sample, archive, measLog );
+                                }
+                                // Log measurement, one row for all channels
+                                if ( archive == NULL ) {
+                                    TRACE_BEGIN ( "log write" );
+                                    fprintf ( measLog, "%s, %s, ppm, %s, C, %s, %%\n", timestamp, valueStr[0], valueStr[1], valueStr[2] );
+                                    TRACE_END ( "log write" );
+                                }
+                                if ( echo ) {
+                                    printf ( "%s, CO2: %s ppm\tT: %s C\tRH: %s %%\n", timestamp, valueStr[0], valueStr[1], valueStr[2] );
+                                }
+                            }
+                        } else if ( SensorReadNTC ( sensor, &meas, &senstype, &unit ) == -1 ) {
+                            childStatus = PS_ERROR;
+                            getTimeStr(timestamp, sizeof(timestamp));
+                            fprintf ( measLog, "%s, %s, %s\n", timestamp, "i2c_read", strerror ( errno ) );
+                        } else {
+                            childStatus = PS_MEASURING;
+                            TRACE_BEGIN ( "format" );
+                            getTimeStr(timestamp, sizeof(timestamp));
+                            TRACE_END ( "format" );
+                            // Log measurement
+                            if ( archive == NULL ) {
+                                TRACE_BEGIN ( "log write" );
+                                fprintf ( measLog, "%s, %d, %c\n", timestamp, meas, unit );
+                                TRACE_END ( "log write" );
+                            }
+                            // Pass measurement to master
+                            sample.timestamp = SampleTimeNow ();
+                            sample.seq = seq++;
+                            sample.value = meas;
+                            sample.sensorAddress = memberArgs[0].sensorAddress;
+                            sample.channel = 0;
+                            sample.decimals = 0;
+                            sample.unit = unit;
+                            SendSample ( dataSocket[runningProcesses][0], &sample, archive, measLog );
+                            if ( echo ) {
+//                                 printf ( "%s, Type: %c Value: %d, %x Unit: %c, %x\n", ctime ( &currentTime.tv_sec ), senstype, meas, meas, unit, unit );
+                                printf ( "%s, Value: %d\tUnit: %c\n", timestamp, meas, unit );
+                            }
+                        }
+                        // Log circuit breaker changes
+                        if ( sensor->counters.trips != prevTrips ) {
+                            getTimeStr(timestamp, sizeof(timestamp));
+                            fprintf ( measLog, "%s, %s, %d s\n", timestamp, "sensor suspended", sensor->cooldown );
+                        } else if ( ( prevState == BREAKER_OPEN ) && ( sensor->breakerState == BREAKER_CLOSED ) ) {
+                            getTimeStr(timestamp, sizeof(timestamp));
+                            fprintf ( measLog, "%s, %s\n", timestamp, "sensor resumed" );
+                        }
+                        if ( pollAgain ) {
+                            // Poll shortly again, this also moves the deadlines to when the sensor has data
+                            nextSample.tv_sec = now.tv_sec;
+                            nextSample.tv_nsec = now.tv_nsec + READYPOLL * 1000000L;
+                            if ( nextSample.tv_nsec >= 1000000000L ) {
+                                nextSample.tv_sec++;
+                                nextSample.tv_nsec -= 1000000000L;
+                            }
+                            continue;
                         }
-                        counter = 0;
+                        // Next deadline, skip the missed ones after an overrun
+                        do {
+                            nextSample.tv_sec += measInterval;
+                        } while ( nextSample.tv_sec <= now.tv_sec );
+                        continue;
                     }
-                    // Check command queue
-                    read ( processSocket[runningProcesses][0], &msg, sizeof ( msg ) );
-                    // Respond commands
-                    if ( msg == 1 ) {
-                        write ( processSocket[runningProcesses][0], &childStatus, sizeof ( childStatus ) );
+                    // Wait for command or next measurement
+                    timeout.tv_sec = nextSample.tv_sec - now.tv_sec;
+                    timeout.tv_nsec = nextSample.tv_nsec - now.tv_nsec;
+                    if ( timeout.tv_nsec < 0 ) {
+                        timeout.tv_sec--;
+                        timeout.tv_nsec += 1000000000L;
                     }
-                    if ( msg == 4 ) {
+                    commandPoll.fd = processSocket[runningProcesses][0];
+                    commandPoll.events = POLLIN;
+                    if ( ppoll ( &commandPoll, 1, &timeout, &childWaitMask ) > 0 ) {
+                        // Check command queue
+                        if ( read ( processSocket[runningProcesses][0], &msg, sizeof ( msg ) ) <= 0 ) {
+                            childTerminate = true;							// Master is gone
+                            msg = 0;
+                        }
+                        // Respond commands
+                        if ( ( msg & COMMANDMASK ) == 1 ) {
+                            SendReply ( processSocket[runningProcesses][0], msg, &childStatus, sizeof ( childStatus ) );
+                        }
+                        if ( ( msg & COMMANDMASK ) == 2 ) {
+                            SensorCounters_t memberCounters[MAXGROUPSIZE];
+
+                            for ( int m = 0; m < members; m++ ) {
+                                sensors[m].counters.breakerState = sensors[m].breakerState;
+                                memberCounters[m] = sensors[m].counters;
+                            }
+                            SendReply ( processSocket[runningProcesses][0], msg, memberCounters, members * sizeof ( SensorCounters_t ) );
+                        }
+                        if ( ( msg & COMMANDMASK ) == 4 ) {
+                            childTerminate = true;
+                        }
+                    }
+                    if ( termSignal ) {
                         childTerminate = true;
                     }
-                    counter++;
+                    if ( TraceRequested () ) {
+                        TraceDump ();
+                    }
                 }
 
-                close(sensorFD);
+                for ( int m = 0; m < members; m++ ) {
+                    sensors[m].counters.breakerState = sensors[m].breakerState;
+                    LogCounters ( measLog, memberArgs[m].sensorAddress, &sensors[m].counters );
+                    SensorClose ( &sensors[m] );
+                }
+                if ( snapshots > 0 ) {
+                    getTimeStr(timestamp, sizeof(timestamp));
+                    fprintf ( measLog, "%s Group %d skew, mean: %lld us, max: %lld us, snapshots: %u\n", timestamp, memberArgs[0].group,
+                              ( long long ) ( skewSum / snapshots / 1000 ), ( long long ) ( skewMax / 1000 ), snapshots );
+                }
+                if ( ( archive != NULL ) && ( ArchiveClose ( archive ) == -1 ) ) {
+                    childLoss.unarchived += ArchiveUnwritten ( archive );
+                    getTimeStr(timestamp, sizeof(timestamp));
+                    fprintf ( measLog, "%s, %s, %s\n", timestamp, "archive", strerror ( errno ) );
+                }
+                // Final reply, the master adds it to the lost samples of the shutdown
+                SendReply ( processSocket[runningProcesses][0], 4, &childLoss, sizeof ( childLoss ) );
+                TraceDump ();
                 close ( processSocket[runningProcesses][0] );				// Child close socket side 0
+                close ( dataSocket[runningProcesses][0] );
+                fflush ( measLog );
+                fsync ( fileno ( measLog ) );
                 fclose ( measLog );
                 exit ( EXIT_SUCCESS );
             }	// End Child process
 
             close ( processSocket[runningProcesses][0] );				// Parent close socket side 0
+            close ( dataSocket[runningProcesses][0] );
+            startedArgs += members;
             runningProcesses++;
+            TRACE_END ( "spawn" );
         }	// End start process
 
         //////////////////////////////////////// Server accepting commands
@@ -504,6 +1272,7 @@ int main ( int argc, char *argv[] ) {
         // and process command
         // increment configuredProcesses
         if ( programMode == 2 ) {
+            TRACE_BEGIN ( "accept" );
             server2ClientSocket = accept ( serverSocket, NULL, 0 );
             if ( server2ClientSocket == -1 ) {
                 if ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) ) {
@@ -515,7 +1284,10 @@ int main ( int argc, char *argv[] ) {
                 }
             } else {
                 printf ( "Receiving command!\n" );
-                while ( read ( server2ClientSocket, &procArgs[configuredProcesses], sizeof ( procArgs[configuredProcesses] ) ) != 0 ) {
+                // Read until the client closes its side, a partial command or an error ends the commands too
+                while ( ( configuredProcesses < MAXPROCESSES )
+                        && ( recv ( server2ClientSocket, &procArgs[configuredProcesses], sizeof ( procArgs[configuredProcesses] ),
+                                    MSG_WAITALL ) == sizeof ( procArgs[configuredProcesses] ) ) ) {
                     configuredProcesses++;
                 }
 
@@ -525,25 +1297,60 @@ int main ( int argc, char *argv[] ) {
 
 				addressStructSize = sizeof(clientAddrStruct);
 				getpeername(server2ClientSocket, &clientAddrStruct, &addressStructSize);
-				get_ip_addr(&clientAddrStruct, strIPAddr);
+				get_ip_addr(&clientAddrStruct, strIPAddr, sizeof(strIPAddr));
 				printf("Received command from: %s\n", strIPAddr);
                 getTimeStr(timestamp, sizeof(timestamp));
                 fprintf ( masterLogfile, "%s, Received command from: %s\n", timestamp, strIPAddr );
+                close ( server2ClientSocket );							// The client takes this as the commands being read
             }
+
+            if ( StreamPoll ( &sampleStream ) > 0 ) {
+                getTimeStr(timestamp, sizeof(timestamp));
+                fprintf ( masterLogfile, "%s, Stream consumer connected, consumers: %d\n", timestamp, sampleStream.count );
+            }
+            TRACE_END ( "accept" );
+        }
+
+        //////////////////////////////////////// Forward measurements
+
+        TRACE_BEGIN ( "forward" );
+        ForwardSamples ( dataSocket, runningProcesses, ( programMode == 2 ) ? &sampleStream : NULL,
+                         spoolEnabled ? &spool : NULL );
+
+        if ( spoolEnabled ) {
+            if ( !SpoolEmpty ( &spool ) && ( sampleStream.count > 0 ) ) {
+                if ( !spoolReplaying ) {
+                    getTimeStr(timestamp, sizeof(timestamp));
+                    fprintf ( masterLogfile, "%s, Spool replay started, queued: %llu, dropped: %llu\n", timestamp,
+                              ( unsigned long long ) spool.queued, ( unsigned long long ) spool.dropped );
+                    spoolReplaying = true;
+                }
+                ReplaySpool ( &sampleStream, &spool, catchupRate );
+            }
+            if ( spoolReplaying && SpoolEmpty ( &spool ) ) {
+                getTimeStr(timestamp, sizeof(timestamp));
+                fprintf ( masterLogfile, "%s, Spool replay finished\n", timestamp );
+                spoolReplaying = false;
+            }
+            SpoolSync ( &spool );
         }
+        TRACE_END ( "forward" );
 
         //////////////////////////////////////// Query children's status
 
-        // Send status request to chidren
-        msg = 1;
+        TRACE_BEGIN ( "status query" );
+        // Send status request to chidren, numbered so that late answers are recognized
+        request = ( ( loopCount & 0x7FFF ) << 8 ) | 1;
         for ( int i = 0; i < runningProcesses; i++ ) {
-            write ( processSocket[i][1], &msg, sizeof ( msg ) );
+            send ( processSocket[i][1], &request, sizeof ( request ), MSG_NOSIGNAL );
         }
 
-        // Wait for respond
+        // Wait for respond, a stuck child must not stall the master
+        clock_gettime ( CLOCK_MONOTONIC, &statusStart );
         for ( int i = 0; i < runningProcesses; i++ ) {
-            msg = 0;
-            read ( processSocket[i][1], &msg, sizeof ( msg ) );
+            if ( ReadReply ( processSocket[i][1], request, &msg, processMembers[i], &statusStart, STATUSTIMEOUT ) == -1 ) {
+                msg = 0;
+            }
             switch ( msg ) {
             case PS_MEASURING:
                 strcpy ( statusMsg, "Measuring\0" );
@@ -551,6 +1358,9 @@ int main ( int argc, char *argv[] ) {
             case PS_ERROR:
                 strcpy ( statusMsg, "Error\0" );
                 break;
+            case PS_SUSPENDED:
+                strcpy ( statusMsg, "Suspended\0" );
+                break;
             default:
                 strcpy ( statusMsg, "Unknown\0" );
             }
@@ -559,51 +1369,138 @@ int main ( int argc, char *argv[] ) {
             fprintf ( masterLogfile, "%s %s\n", timestamp, statusMsg );
 			printf ( "%s %s\n", timestamp, statusMsg );
         }	// End wait for respond
+        TRACE_END ( "status query" );
+
+        //////////////////////////////////////// Query sensor failure counters
+
+        if ( ( ++loopCount % COUNTERINTERVAL ) == 0 ) {
+            TRACE_BEGIN ( "counters query" );
+            request = ( ( loopCount & 0x7FFF ) << 8 ) | 2;
+            for ( int i = 0; i < runningProcesses; i++ ) {
+                send ( processSocket[i][1], &request, sizeof ( request ), MSG_NOSIGNAL );
+            }
+            clock_gettime ( CLOCK_MONOTONIC, &statusStart );
+            for ( int i = 0; i < runningProcesses; i++ ) {
+                if ( ReadReply ( processSocket[i][1], request, counters, processMembers[i], &statusStart, STATUSTIMEOUT ) == 0 ) {
+                    for ( int m = 0; m < processMembers[i]; m++ ) {
+                        LogCounters ( masterLogfile, procArgs[processFirstArg[i] + m].sensorAddress, &counters[m] );
+                    }
+                }
+            }
+            TRACE_END ( "counters query" );
+        }
+
+        //////////////////////////////////////// Write trace on request
+
+        if ( TraceRequested () ) {
+            for ( int i = 0; i < runningProcesses; i++ ) {
+                kill ( processes[i], SIGUSR1 );
+            }
+            rv = TraceDump ();
+            getTimeStr(timestamp, sizeof(timestamp));
+            fprintf ( masterLogfile, "%s Trace written to %s, events: %d, unmatched ends dropped: %u\n", timestamp,
+                      traceFileName, rv, TraceUnmatched () );
+        }
 
         //////////////////////////////////////// Check quit status
 
+        TRACE_BEGIN ( "quit check" );
         // Check quit status, ask user if really quit
-        if ( quitSignal == true ) {
+        // Without a terminal (service, pipe) nobody can answer, SIGINT quits like SIGTERM
+        if ( ( quitSignal == true ) && !termSignal && isatty ( STDIN_FILENO ) ) {
             printf ( "Really quit? (y)\n" );
             while ( ( msg = getchar() ) == EOF )
                 ;
 //             printf ( "User answered: %c, %d\n", msg, msg );
 
             if ( toupper ( msg ) == 'Y' ) {
-                // Send terminate signal to chidren
-                msg = 4;
-                for ( int i = 0; i < runningProcesses; i++ ) {
-                    write ( processSocket[i][1], &msg, sizeof ( msg ) );
-                }
-                // write termination status to log file
-                for ( int i = 0; i < runningProcesses; i++ ) {
-                    wait ( &exitStatus );
-                    if ( WIFEXITED ( exitStatus ) ) {
-                        // log WEXITSTATUS(exitStatus)
-                        getTimeStr(timestamp, sizeof(timestamp));
-                        fprintf ( masterLogfile, "%s Process terminated normally with code: %d\n", timestamp, WEXITSTATUS ( exitStatus ) );
-                    }
-                    if ( WIFSIGNALED ( exitSignal ) ) {
-                        getTimeStr(timestamp, sizeof(timestamp));
-                        fprintf ( masterLogfile, "%s Process terminated abnormally by signal: %d\n", timestamp, WTERMSIG ( exitStatus ) );
-                    }
-                }
-
-                printf ( "\nReceived term signal. Quitting...\n" );
+                clock_gettime ( CLOCK_MONOTONIC, &shutdownStart );
                 exitSignal = true;
             } else {
                 // User cancelled exit
                 quitSignal = false;
             }
+        } else if ( termSignal || ( quitSignal == true ) ) {
+            if ( termSignal ) {
+                shutdownStart = termTime;
+            } else {
+                clock_gettime ( CLOCK_MONOTONIC, &shutdownStart );
+            }
+            exitSignal = true;
         }	// End quit signal check
-
-        // Sleep until next timer (1 second)
-        sigsuspend ( &timermask );
+        TRACE_END ( "quit check" );
+
+        if ( exitSignal ) {
+            printf ( "\nReceived term signal. Quitting...\n" );
+            // The deadline runs from the arrival of the signal
+            rv = drainTimeout - ( int ) ( ElapsedNs ( &shutdownStart ) / 1000000LL );
+            killedProcesses = ShutdownChildren ( processes, processSocket, dataSocket, runningProcesses, processMembers,
+                                                 processSamples, ( rv > 0 ) ? rv : 0,
+                                                 ( programMode == 2 ) ? &sampleStream : NULL, spoolEnabled ? &spool : NULL,
+                                                 masterLogfile, &lostSamples );
+        } else {
+            // Sleep until next timer (1 second), forward the samples as they arrive meanwhile
+            for ( int i = 0; i < runningProcesses; i++ ) {
+                dataPoll[i].fd = dataSocket[i][1];
+                dataPoll[i].events = POLLIN;
+            }
+            TRACE_BEGIN ( "sigsuspend" );
+            while ( !tickSignal && !quitSignal && !termSignal ) {
+                if ( ppoll ( dataPoll, runningProcesses, NULL, &timermask ) > 0 ) {
+                    ForwardSamples ( dataSocket, runningProcesses, ( programMode == 2 ) ? &sampleStream : NULL,
+                                     spoolEnabled ? &spool : NULL );
+                }
+            }
+            tickSignal = false;
+            TRACE_END ( "sigsuspend" );
+        }
     }	// End while loop
 
     //////////////////////////////////////// Final clean-up
 
+    // Measuring processes are gone, nothing more to alarm on. The dispatcher gets what is left of the deadline.
+    if ( alarmDispatcher > 0 ) {
+        rv = drainTimeout - ( int ) ( ElapsedNs ( &shutdownStart ) / 1000000LL );
+        AlarmStop ( alarmDispatcher, ( rv > 0 ) ? rv : 0, masterLogfile );
+        close ( alarmSocket );
+    }
+
+    if ( programMode == 2 ) {
+        ForwardSamples ( dataSocket, runningProcesses, &sampleStream, spoolEnabled ? &spool : NULL );
+        StreamClose ( &sampleStream );
+        close ( serverSocket );
+    }
+    if ( spoolEnabled ) {
+        getTimeStr(timestamp, sizeof(timestamp));
+        fprintf ( masterLogfile, "%s, Spool closed, queued: %llu, dropped: %llu\n", timestamp,
+                  ( unsigned long long ) spool.queued, ( unsigned long long ) spool.dropped );
+        spoolDropped = spool.dropped;
+        SpoolClose ( &spool );
+    }
+
+    // Report shutdown. Lost samples: the reading a killed process was taking (every channel and group member),
+    // what the drained processes could not send or archive, what no consumer got and the spool overflow.
+    // A killed process writing an archive also loses its open blocks, the master cannot count those.
+    getTimeStr(timestamp, sizeof(timestamp));
+    exitStatus = ( int ) ( ElapsedNs ( &shutdownStart ) / 1000 );
+    lostTotal = ( uint64_t ) lostSamples.unsent + lostSamples.unarchived + unstreamedSamples + spoolDropped;
+    printf ( "Shutdown completed in %d.%03d ms, processes drained: %d/%d, killed: %d, lost samples: %llu\n",
+             exitStatus / 1000, exitStatus % 1000, runningProcesses - killedProcesses, runningProcesses, killedProcesses,
+             ( unsigned long long ) lostTotal );
+    fprintf ( masterLogfile, "%s Shutdown completed in %d.%03d ms, processes drained: %d/%d, killed: %d, lost samples: %llu\n",
+              timestamp, exitStatus / 1000, exitStatus % 1000, runningProcesses - killedProcesses, runningProcesses, killedProcesses,
+              ( unsigned long long ) lostTotal );
+    if ( lostTotal > 0 ) {
+        fprintf ( masterLogfile, "%s Lost samples, not sent: %u, not archived: %u, no consumer: %llu, spool overflow: %llu\n",
+                  timestamp, lostSamples.unsent, lostSamples.unarchived, ( unsigned long long ) unstreamedSamples,
+                  ( unsigned long long ) spoolDropped );
+    }
+
+    TraceDump ();
+    fflush ( masterLogfile );
+    fsync ( fileno ( masterLogfile ) );
     fclose ( masterLogfile );
     sigaction ( SIGINT, &oldHandler, NULL );						// Restore old signal handler
+    sigaction ( SIGTERM, &oldTermHandler, NULL );
     return 0;
 }	// End of main function
@@ -0,0 +1,481 @@
+/*
+ * File:			smarchive.c
+ *
+ * Author:			Zoltan Gere
+ * Created:			05/16/20
+ * Description:		Tool for the compressed measurement archives
+ *                  encode - convert a measurement log to an archive
+ *                  decode - print an archive as text
+ *                  query  - print the samples of a time or value range, skipping blocks by their headers
+ *                  bench  - compression ratio and decoding speed
+ *
+ * <MIT License>
+ */
+
+#define _XOPEN_SOURCE 700			// strptime
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <ctype.h>
+
+#include "Archive.h"
+#include "Sample.h"
+
+#define MAXLINELENGTH (256)
+#define MAXROWVALUES (8)				// Values in one log row (snapshot groups)
+#define BENCHTIME (1000000000LL)		// ns the decoding is repeated for
+
+typedef struct {
+    int address;
+    int channel;						// -1 all
+    int64_t from;						// ms, inclusive
+    int64_t to;							// ms, exclusive
+    int64_t above;						// Only values above, scaled as stored; wider than a value so
+    int64_t below;						// the defaults let INT32_MIN and INT32_MAX through
+} Query_t;
+
+static int64_t MonotonicNs ( void ) {
+    struct timespec now;
+
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return ( int64_t ) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * @brief Parse a scaled decimal number, "21.75" is 2175 with 2 decimals
+ *
+ * @return int 0 on success, -1 if it is not a number
+ */
+static int ParseValue ( const char * text, int32_t * value, uint8_t * decimals ) {
+    long long v = 0;
+    bool negative = false;
+    bool fraction = false;
+
+    *decimals = 0;
+    while ( *text == ' ' )
+        text++;
+    if ( *text == '-' ) {
+        negative = true;
+        text++;
+    }
+    if ( !isdigit ( ( unsigned char ) *text ) )
+        return -1;
+    for ( ; *text != '\0'; text++ ) {
+        if ( isdigit ( ( unsigned char ) *text ) ) {
+            v = v * 10 + ( *text - '0' );
+            if ( fraction )
+                ( *decimals )++;
+        } else if ( ( *text == '.' ) && !fraction ) {
+            fraction = true;
+        } else {
+            return -1;
+        }
+        if ( v > INT32_MAX )
+            return -1;
+    }
+    *value = ( int32_t ) ( negative ? -v : v );
+    return 0;
+}
+
+/**
+ * @brief Parse a measurement row: time, value, unit[, value, unit ...][, skew n us]
+ *        Values are numbered as channels in the order of the row.
+ *
+ * @return int number of samples, 0 if the line is not a measurement row
+ */
+static int ParseRow ( char * line, int address, Sample_t * samples ) {
+    struct tm tm;
+    char * field[2 * MAXROWVALUES + 2];
+    int fields = 0;
+    int count = 0;
+    char * end;
+    time_t t;
+
+    line[strcspn ( line, "\r\n" )] = '\0';
+    for ( char * p = strtok ( line, "," ); ( p != NULL ) && ( fields < ( int ) ( sizeof ( field ) / sizeof ( field[0] ) ) ); p = strtok ( NULL, "," ) ) {
+        while ( *p == ' ' )
+            p++;
+        field[fields++] = p;
+    }
+    if ( fields < 3 )
+        return 0;
+    memset ( &tm, 0, sizeof ( tm ) );
+    end = strptime ( field[0], "%a %b %d %H:%M:%S %Y", &tm );
+    if ( ( end == NULL ) || ( *end != '\0' ) )
+        return 0;
+    tm.tm_isdst = -1;
+    t = mktime ( &tm );
+
+    for ( int i = 1; i + 1 < fields; i += 2 ) {
+        if ( strcmp ( field[i], "-" ) == 0 )
+            continue;											// Group member not read
+        if ( ParseValue ( field[i], &samples[count].value, &samples[count].decimals ) == -1 )
+            return ( count > 0 ) ? count : 0;
+        samples[count].timestamp = ( int64_t ) t * 1000000000LL;
+        samples[count].seq = 0;
+        samples[count].sensorAddress = ( uint16_t ) address;
+        samples[count].channel = ( uint8_t ) ( ( i - 1 ) / 2 );
+        samples[count].unit = field[i + 1][0];
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Read all measurement rows of a log
+ *
+ * @return Sample_t* samples, NULL on error
+ */
+static Sample_t * ReadLog ( const char * fileName, int address, size_t * count, size_t * textBytes ) {
+    FILE * log;
+    char line[MAXLINELENGTH];
+    Sample_t row[MAXROWVALUES];
+    Sample_t * samples = NULL;
+    size_t capacity = 0;
+    int n;
+
+    *count = 0;
+    *textBytes = 0;
+    log = fopen ( fileName, "r" );
+    if ( log == NULL ) {
+        perror ( fileName );
+        return NULL;
+    }
+    while ( fgets ( line, sizeof ( line ), log ) != NULL ) {
+        size_t length = strlen ( line );
+
+        n = ParseRow ( line, address, row );
+        if ( n == 0 )
+            continue;
+        *textBytes += length;
+        if ( *count + n > capacity ) {
+            capacity = ( capacity == 0 ) ? 4096 : capacity * 2;
+            samples = realloc ( samples, capacity * sizeof ( Sample_t ) );
+            if ( samples == NULL ) {
+                perror ( "realloc" );
+                fclose ( log );
+                return NULL;
+            }
+        }
+        memcpy ( samples + *count, row, n * sizeof ( Sample_t ) );
+        *count += n;
+    }
+    fclose ( log );
+    if ( samples == NULL )
+        samples = malloc ( sizeof ( Sample_t ) );
+    return samples;
+}
+
+/**
+ * @brief One year-like series of a near-constant NTC at 1 Hz with ms jitter
+ */
+static Sample_t * Synthetic ( size_t count, size_t * textBytes ) {
+    Sample_t * samples = malloc ( count * sizeof ( Sample_t ) );
+    unsigned int seed = 1;
+    int64_t t = 1590000000000LL;								// ms
+    int32_t value = 215;
+    char line[MAXLINELENGTH];
+    time_t seconds;
+
+    *textBytes = 0;
+    if ( samples == NULL )
+        return NULL;
+    for ( size_t i = 0; i < count; i++ ) {
+        if ( rand_r ( &seed ) % 60 == 0 )
+            value += ( rand_r ( &seed ) % 2 ) ? 1 : -1;			// Slow drift
+        t += 1000;
+        samples[i].timestamp = ( t + rand_r ( &seed ) % 5 ) * 1000000LL;
+        samples[i].seq = i;
+        samples[i].value = value;
+        samples[i].sensorAddress = 0x10;
+        samples[i].channel = 0;
+        samples[i].decimals = 0;
+        samples[i].unit = 'C';
+        seconds = ( time_t ) ( t / 1000 );
+        *textBytes += snprintf ( line, sizeof ( line ), "%.24s, %d, %c\n", ctime ( &seconds ), value, 'C' );
+    }
+    return samples;
+}
+
+static int WriteArchive ( const char * fileName, const Sample_t * samples, size_t count, uint64_t * bytes ) {
+    static ArchiveWriter_t writer;
+
+    if ( ArchiveOpen ( &writer, fileName ) == -1 ) {
+        perror ( fileName );
+        return -1;
+    }
+    for ( size_t i = 0; i < count; i++ ) {
+        if ( ArchiveAppend ( &writer, &samples[i] ) == -1 ) {
+            perror ( fileName );
+            ArchiveClose ( &writer );
+            return -1;
+        }
+    }
+    if ( ArchiveClose ( &writer ) == -1 ) {
+        perror ( fileName );
+        return -1;
+    }
+    *bytes = writer.bytes;
+    return 0;
+}
+
+static void PrintSample ( const Sample_t * s ) {
+    char timeStr[32];
+    char valueStr[16];
+    time_t seconds = ( time_t ) ( s->timestamp / 1000000000LL );
+    struct tm tm;
+
+    localtime_r ( &seconds, &tm );
+    strftime ( timeStr, sizeof ( timeStr ), "%Y-%m-%d %H:%M:%S", &tm );
+    SampleFormatValue ( s, valueStr, sizeof ( valueStr ) );
+    printf ( "%s.%03d, 0x%02x, %u, %s, %c\n", timeStr, ( int ) ( ( s->timestamp / 1000000 ) % 1000 ),
+             s->sensorAddress, s->channel, valueStr, ( s->unit != '\0' ) ? s->unit : '-' );
+}
+
+/**
+ * @brief Time argument: seconds since epoch or "YYYY-MM-DD HH:MM:SS" local time
+ */
+static int64_t ParseTime ( const char * text ) {
+    struct tm tm;
+    char * end;
+
+    memset ( &tm, 0, sizeof ( tm ) );
+    end = strptime ( text, "%Y-%m-%d %H:%M:%S", &tm );
+    if ( ( end != NULL ) && ( *end == '\0' ) ) {
+        tm.tm_isdst = -1;
+        return ( int64_t ) mktime ( &tm ) * 1000;
+    }
+    return strtoll ( text, NULL, 10 ) * 1000;
+}
+
+static bool BlockMatches ( const ArchiveBlockHeader_t * h, const Query_t * q ) {
+    return ( ( q->address < 0 ) || ( h->sensorAddress == q->address ) )
+           && ( ( q->channel < 0 ) || ( h->channel == q->channel ) )
+           && ( h->lastTime >= q->from ) && ( h->firstTime < q->to )
+           && ( h->maxValue > q->above ) && ( h->minValue < q->below );
+}
+
+static int Query ( const char * fileName, const Query_t * q, bool quiet ) {
+    static ArchiveReader_t reader;
+    static Sample_t samples[ARCHIVEBLOCKSAMPLES];
+    uint64_t blocks = 0, skipped = 0, matched = 0;
+    int64_t ms;
+    int n, rv;
+
+    if ( ArchiveReaderOpen ( &reader, fileName ) == -1 ) {
+        perror ( fileName );
+        return -1;
+    }
+    while ( ( rv = ArchiveNextBlock ( &reader ) ) == 1 ) {
+        blocks++;
+        if ( !BlockMatches ( &reader.header, q ) ) {
+            skipped++;
+            continue;
+        }
+        if ( ( n = ArchiveReadBlock ( &reader, samples ) ) == -1 ) {
+            rv = -1;
+            break;
+        }
+        for ( int i = 0; i < n; i++ ) {
+            ms = samples[i].timestamp / 1000000;
+            if ( ( ms >= q->from ) && ( ms < q->to ) && ( samples[i].value > q->above ) && ( samples[i].value < q->below ) ) {
+                matched++;
+                if ( !quiet )
+                    PrintSample ( &samples[i] );
+            }
+        }
+    }
+    ArchiveReaderClose ( &reader );
+    if ( rv == -1 ) {
+        fprintf ( stderr, "%s: damaged archive\n", fileName );
+        return -1;
+    }
+    fprintf ( stderr, "Blocks: %llu, skipped: %llu, samples: %llu\n", ( unsigned long long ) blocks,
+              ( unsigned long long ) skipped, ( unsigned long long ) matched );
+    return 0;
+}
+
+/**
+ * @brief Compression ratio against the text log and in-memory decoding speed
+ */
+static int Bench ( const Sample_t * samples, size_t count, size_t textBytes ) {
+    static ArchiveReader_t reader;
+    static Sample_t decoded[ARCHIVEBLOCKSAMPLES];
+    char fileName[] = "/tmp/smarchiveXXXXXX";
+    ArchiveBlockHeader_t * headers = NULL;
+    uint8_t * payloads = NULL;
+    size_t * offsets = NULL;
+    size_t blocks = 0, capacity = 0, payloadSize = 0;
+    uint64_t archiveBytes;
+    uint64_t decodedSamples = 0;
+    int64_t start, elapsed;
+    int fd, n;
+    int rv = -1;
+
+    if ( count == 0 ) {
+        fprintf ( stderr, "No samples\n" );
+        return -1;
+    }
+    fd = mkstemp ( fileName );
+    if ( fd == -1 ) {
+        perror ( "mkstemp" );
+        return -1;
+    }
+    close ( fd );
+    unlink ( fileName );
+    if ( WriteArchive ( fileName, samples, count, &archiveBytes ) == -1 )
+        return -1;
+    archiveBytes += ARCHIVEHEADERSIZE;
+
+    // Load the blocks into memory, the decoding is timed without file access
+    if ( ArchiveReaderOpen ( &reader, fileName ) == -1 ) {
+        perror ( fileName );
+        goto done;
+    }
+    payloads = malloc ( archiveBytes );
+    while ( ( payloads != NULL ) && ( ArchiveNextBlock ( &reader ) == 1 ) ) {
+        if ( blocks == capacity ) {
+            capacity = ( capacity == 0 ) ? 256 : capacity * 2;
+            headers = realloc ( headers, capacity * sizeof ( *headers ) );
+            offsets = realloc ( offsets, capacity * sizeof ( *offsets ) );
+            if ( ( headers == NULL ) || ( offsets == NULL ) )
+                break;
+        }
+        if ( ArchiveReadBlock ( &reader, decoded ) == -1 )
+            break;
+        headers[blocks] = reader.header;
+        offsets[blocks] = payloadSize;
+        memcpy ( payloads + payloadSize, reader.payload, reader.header.payloadBytes );
+        payloadSize += reader.header.payloadBytes;
+        blocks++;
+    }
+    ArchiveReaderClose ( &reader );
+    if ( ( blocks == 0 ) || ( headers == NULL ) || ( offsets == NULL ) ) {
+        fprintf ( stderr, "Reading back the archive failed\n" );
+        goto done;
+    }
+
+    start = MonotonicNs ();
+    do {
+        for ( size_t b = 0; b < blocks; b++ ) {
+            n = ArchiveDecode ( &headers[b], payloads + offsets[b], decoded );
+            if ( n == -1 ) {
+                fprintf ( stderr, "Decoding failed\n" );
+                goto done;
+            }
+            decodedSamples += n;
+        }
+        elapsed = MonotonicNs () - start;
+    } while ( elapsed < BENCHTIME );
+
+    printf ( "Samples: %zu, blocks: %zu\n", count, blocks );
+    printf ( "Text: %zu bytes, %.2f bytes/sample\n", textBytes, ( double ) textBytes / count );
+    printf ( "Archive: %llu bytes, %.3f bytes/sample, ratio: %.1f\n", ( unsigned long long ) archiveBytes,
+             ( double ) archiveBytes / count, ( double ) textBytes / archiveBytes );
+    printf ( "Decode: %.1f Msamples/s, %.2f GB/s of samples (%d bytes), %.2f GB/s of text\n",
+             decodedSamples * 1e3 / elapsed, decodedSamples * SAMPLEWIRESIZE / ( double ) elapsed, SAMPLEWIRESIZE,
+             decodedSamples * ( ( double ) textBytes / count ) / elapsed );
+    rv = 0;
+
+done:
+    unlink ( fileName );
+    free ( headers );
+    free ( offsets );
+    free ( payloads );
+    return rv;
+}
+
+static void Usage ( const char * name ) {
+    printf ( "Usage:\n" );
+    printf ( "%s encode <measurement_log> <archive> -address <address>\n", name );
+    printf ( "%s decode <archive>\n", name );
+    printf ( "%s query <archive> [-address <address>] [-channel <n>] [-from <time>] [-to <time>] [-above <value>] [-below <value>] [-count]\n", name );
+    printf ( "%s bench <measurement_log> -address <address>\n", name );
+    printf ( "%s bench -synthetic <samples>\n", name );
+    printf ( "Time is seconds since epoch or \"YYYY-MM-DD HH:MM:SS\". Values are compared as stored, scaled by 10^decimals.\n" );
+    printf ( "Rows of the measurement log with several values are stored as channels 0, 1, ...\n" );
+}
+
+int main ( int argc, char * argv[] ) {
+    Query_t query = { -1, -1, INT64_MIN, INT64_MAX, INT64_MIN, INT64_MAX };
+    bool quiet = false;
+    long long synthetic = 0;
+    Sample_t * samples;
+    size_t count, textBytes;
+    uint64_t bytes;
+    int rv;
+
+    if ( argc < 3 ) {
+        Usage ( argv[0] );
+        return EXIT_FAILURE;
+    }
+    for ( int i = 2; i < argc; i++ ) {
+        if ( ( strcmp ( argv[i], "-address" ) == 0 ) && ( i + 1 < argc ) )
+            sscanf ( argv[++i], "%x", &query.address );
+        else if ( ( strcmp ( argv[i], "-channel" ) == 0 ) && ( i + 1 < argc ) )
+            query.channel = atoi ( argv[++i] );
+        else if ( ( strcmp ( argv[i], "-from" ) == 0 ) && ( i + 1 < argc ) )
+            query.from = ParseTime ( argv[++i] );
+        else if ( ( strcmp ( argv[i], "-to" ) == 0 ) && ( i + 1 < argc ) )
+            query.to = ParseTime ( argv[++i] );
+        else if ( ( strcmp ( argv[i], "-above" ) == 0 ) && ( i + 1 < argc ) )
+            query.above = atoll ( argv[++i] );
+        else if ( ( strcmp ( argv[i], "-below" ) == 0 ) && ( i + 1 < argc ) )
+            query.below = atoll ( argv[++i] );
+        else if ( ( strcmp ( argv[i], "-synthetic" ) == 0 ) && ( i + 1 < argc ) )
+            synthetic = atoll ( argv[++i] );
+        else if ( strcmp ( argv[i], "-count" ) == 0 )
+            quiet = true;
+    }
+
+    if ( ( strcmp ( argv[1], "encode" ) == 0 ) && ( argc > 3 ) ) {
+        if ( query.address < 0 ) {
+            printf ( "Missing sensor address!\n" );
+            return EXIT_FAILURE;
+        }
+        samples = ReadLog ( argv[2], query.address, &count, &textBytes );
+        if ( samples == NULL )
+            return EXIT_FAILURE;
+        rv = WriteArchive ( argv[3], samples, count, &bytes );
+        if ( rv == 0 )
+            printf ( "Samples: %zu, text: %zu bytes, archive: %llu bytes\n", count, textBytes, ( unsigned long long ) bytes );
+        free ( samples );
+        return ( rv == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if ( strcmp ( argv[1], "decode" ) == 0 ) {
+        Query_t all = { -1, -1, INT64_MIN, INT64_MAX, INT64_MIN, INT64_MAX };
+
+        return ( Query ( argv[2], &all, false ) == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if ( strcmp ( argv[1], "query" ) == 0 ) {
+        return ( Query ( argv[2], &query, quiet ) == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if ( strcmp ( argv[1], "bench" ) == 0 ) {
+        if ( synthetic > 0 ) {
+            count = ( size_t ) synthetic;
+            samples = Synthetic ( count, &textBytes );
+        } else {
+            if ( query.address < 0 ) {
+                printf ( "Missing sensor address!\n" );
+                return EXIT_FAILURE;
+            }
+            samples = ReadLog ( argv[2], query.address, &count, &textBytes );
+        }
+        if ( samples == NULL )
+            return EXIT_FAILURE;
+        rv = Bench ( samples, count, textBytes );
+        free ( samples );
+        return ( rv == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    Usage ( argv[0] );
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,103 @@
+#!/bin/sh
+#
+# Compressed archive round trip. Simulated sensors write archives while a
+# collector stores the same samples as text; smarchive decode and query must
+# give back exactly those samples. A crafted log with counter wraps, huge
+# value and time jumps and full worst case blocks goes through encode,
+# decode and query and must come back unchanged.
+#
+# Usage: archive_roundtrip.sh <sensormaster> <smarchive>
+
+SM=$1
+SMA=$2
+DIR=$(mktemp -d)
+trap 'kill $S $C 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+TZ=UTC
+export TZ
+
+fail () {
+    echo "FAIL: $1"
+    exit 1
+}
+
+# "sec.ms, board, address, channel, seq, value, unit" -> "YYYY-MM-DD HH:MM:SS.ms, address, channel, value, unit"
+store2text () {
+    sed -n "s/^\([0-9]*\)\.\([0-9]*\), [^,]*, $1, \([0-9]*\), [0-9]*, \(.*\)/@\1 \2, $1, \3, \4/p" store.txt > rows.txt
+    cut -d ' ' -f 1 rows.txt | date -f - '+%Y-%m-%d %H:%M:%S' > times.txt
+    cut -d ' ' -f 2- rows.txt | paste -d . times.txt - | sort
+}
+
+#################### Simulated sensors, archive against the collected stream
+
+cat > cmds.txt << EOF
+-sensortype NTC -sensoraddress 10 -interval 1 -bus sim -archive $DIR/a10.sma
+-sensortype NTC -sensoraddress 11 -interval 1 -bus sim -group 1 -archive $DIR/agroup.sma
+-sensortype NTC -sensoraddress 12 -interval 1 -bus sim -group 1
+-sensortype SCC -sensoraddress 61 -bus sim -archive $DIR/a61.sma
+EOF
+printf "127.0.0.1:47800\n" > boards.txt
+
+"$SM" -s -p 47800 -f cmds.txt -l s.log > /dev/null 2>&1 &
+S=$!
+sleep 0.3
+"$SM" -collect boards.txt -store store.txt -window 200 -l c.log > /dev/null 2>&1 &
+C=$!
+sleep 8
+kill -TERM $S
+wait $S
+sleep 0.5
+kill -TERM $C
+wait $C
+
+grep -q "lost samples: 0$" s.log || fail "samples lost: $(grep "Shutdown completed" s.log)"
+for archive in a10 agroup a61; do
+    "$SMA" decode $archive.sma 2> /dev/null | sort > $archive.txt || fail "decode of $archive failed"
+done
+store2text 0x10 > s10.txt
+{ store2text 0x11; store2text 0x12; } | sort > sgroup.txt
+store2text 0x61 > s61.txt
+for archive in 10 group 61; do
+    [ -s s$archive.txt ] || fail "no samples of $archive collected"
+    cmp -s a$archive.txt s$archive.txt || { diff a$archive.txt s$archive.txt; fail "archive $archive differs from the collected samples"; }
+done
+# SCD30 channel 0 is CO2, the model stays above 400 ppm
+"$SMA" query a61.sma -channel 0 -above 399 2> /dev/null | sort > q61.txt
+grep ", 0x61, 0, " s61.txt | cmp -s q61.txt - || fail "query of the CO2 channel differs from the collected samples"
+echo "OK: $(cat a10.txt agroup.txt a61.txt | wc -l) samples of the simulated sensors archived"
+
+#################### Crafted log, wraps and jumps
+
+# Two channels per row. Channel 0 is a counter wrapping at 2^31 and at 2^16,
+# then it jumps between the extremes of int32. Channel 1 has two decimals and
+# crosses zero. Two rows a second fill two blocks per channel with the widest
+# value encoding, about 8 kB each, written in one go. Then the time jumps by
+# days, every row starts new blocks.
+awk 'BEGIN {
+    t = 1590000000; c = 2147483640; v = -150
+    for ( i = 0; i < 2060; i++ ) {
+        if ( i < 16 ) { c = ( c == 2147483647 ) ? -2147483647 : c + 1 }
+        else if ( i < 32 ) { c = ( i == 16 ) ? 65530 : ( ( c == 65535 ) ? 0 : c + 1 ) }
+        else { c = ( i % 2 ) ? 2147483647 : -2147483647 }
+        v += ( i % 7 ) * 13 - 30
+        t += ( i < 2048 ) ? i % 2 : 86400 * ( 1 + i % 5 )
+        printf "@%d %d %d\n", t, c, v
+    }
+}' > crafted.txt
+cut -d ' ' -f 1 crafted.txt | date -f - '+%a %b %e %H:%M:%S %Y' > ctimes.txt
+cut -d ' ' -f 1 crafted.txt | date -f - '+%Y-%m-%d %H:%M:%S' > dtimes.txt
+cut -d ' ' -f 2- crafted.txt | awk '{ v = $2; printf "%s%d.%02d\n", ( v < 0 ) ? "-" : "", ( v < 0 ? -v : v ) / 100, ( v < 0 ? -v : v ) % 100 }' > fixed.txt
+cut -d ' ' -f 2 crafted.txt | paste -d ' ' ctimes.txt - fixed.txt | awk '{ print $1 " " $2 " " $3 " " $4 " " $5 ", " $6 ", n, " $7 ", C" }' > crafted.log
+{
+    cut -d ' ' -f 2 crafted.txt | paste -d ' ' dtimes.txt - | awk '{ print $1 " " $2 ".000, 0x20, 0, " $3 ", n" }'
+    paste -d ' ' dtimes.txt fixed.txt | awk '{ print $1 " " $2 ".000, 0x20, 1, " $3 ", C" }'
+} | sort > expected.txt
+
+"$SMA" encode crafted.log crafted.sma -address 20 > /dev/null || fail "encode failed"
+"$SMA" decode crafted.sma 2> /dev/null | sort > decoded.txt || fail "decode failed"
+cmp -s decoded.txt expected.txt || { diff decoded.txt expected.txt | head; fail "crafted log does not round trip"; }
+"$SMA" query crafted.sma -channel 0 -above 2147483646 2> /dev/null | sort > top.txt
+grep ", 0x20, 0, 2147483647, " expected.txt | cmp -s top.txt - || fail "query of the int32 maximum differs"
+blocks=$("$SMA" query crafted.sma -count 2>&1 | sed -n 's/^Blocks: \([0-9]*\),.*/\1/p')
+[ "$blocks" = 28 ] || fail "expected 2 full and 12 single row blocks per channel, got $blocks blocks"
+echo "OK: $(wc -l < decoded.txt) crafted samples in $blocks blocks round trip"
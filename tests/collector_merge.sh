@@ -0,0 +1,76 @@
+#!/bin/sh
+#
+# Collector mode over loopback: tens of servers with simulated sensors, one
+# collector reading the board list. The store must hold the samples of every
+# board in time order, no sample may be late and every board must be up with
+# a lag within the sampling interval and the reorder window.
+#
+# Usage: collector_merge.sh <sensormaster>
+
+SM=$1
+BOARDS=24
+WINDOW=500
+DIR=$(mktemp -d)
+trap 'kill $C $PIDS 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+# A server listens on its port and streams samples on the next one
+PIDS=
+echo "# Boards of the merge test" > boards.txt
+for i in $(seq $BOARDS); do
+    port=$(( 47100 + 2 * i ))
+    printf -- "-sensortype NTC -sensoraddress 10 -interval 1 -bus sim\n" > b$port.txt
+    # Every third board has a second sensor
+    if [ $(( i % 3 )) -eq 0 ]; then
+        printf -- "-sensortype NTC -sensoraddress 11 -interval 1 -bus sim\n" >> b$port.txt
+    fi
+    "$SM" -s -p $port -f b$port.txt -l s$port.log > /dev/null 2>&1 &
+    PIDS="$PIDS $!"
+    echo "127.0.0.1:$port" >> boards.txt
+done
+sleep 2
+"$SM" -collect boards.txt -store store.txt -window $WINDOW -l c.log > /dev/null 2>&1 &
+C=$!
+sleep 6
+kill -TERM $C
+wait $C
+kill -TERM $PIDS
+
+fail () {
+    echo "FAIL: $1"
+    tail -n $BOARDS c.log
+    exit 1
+}
+
+# Fields: time, board, address, channel, seq, value, unit
+for i in $(seq $BOARDS); do
+    port=$(( 47100 + 2 * i ))
+    grep -q ":$port, 0x10, " store.txt || fail "no samples of board $port"
+    if [ $(( i % 3 )) -eq 0 ]; then
+        grep -q ":$port, 0x11, " store.txt || fail "no samples of the second sensor of board $port"
+    fi
+done
+# Time ordered across the boards, in sequence within every sensor
+awk -F', ' '
+    $1 + 0 < last { print "FAIL: out of order at line " NR ": " $0; bad = 1 }
+    { last = $1 + 0 }
+    ( $2 SUBSEP $3 ) in seq && $5 + 0 <= seq[$2, $3] { print "FAIL: sequence of " $2 " " $3 " at line " NR; bad = 1 }
+    { seq[$2, $3] = $5 + 0 }
+    END { exit bad }' store.txt || exit 1
+# Board statistics at exit: "time, name, up, lag N ms, received n, buffered n, late n, connects n"
+tail -n $BOARDS c.log | awk -F', ' -v boards=$BOARDS -v limit=$(( 1000 + WINDOW )) '
+    {
+        n++
+        lag = $4; sub ( /lag /, "", lag ); sub ( / ms/, "", lag ); lag += 0
+        late = $7; sub ( /late /, "", late )
+        if ( $3 != "up" ) { print "FAIL: board " $2 " is " $3; bad = 1 }
+        if ( lag < 0 || lag > limit ) { print "FAIL: board " $2 " lag " lag " ms"; bad = 1 }
+        if ( late + 0 > 0 ) { print "FAIL: board " $2 " has " late " late samples"; bad = 1 }
+        if ( lag > max ) max = lag
+    }
+    END {
+        if ( n != boards ) { print "FAIL: statistics of " n " boards"; bad = 1 }
+        if ( !bad ) print "OK: " boards " boards, max lag " max " ms"
+        exit bad
+    }' || exit 1
+echo "OK: $(wc -l < store.txt) samples merged"
@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# Failure injection on simulated sensors: a flaky sensor must be retried,
+# a dead one must be suspended by the breaker, sensors that fail now and
+# then must be suspended and resumed by a probe, and a healthy one on the
+# same server must not be affected.
+#
+# Usage: failure_injection.sh <sensormaster>
+
+SM=$1
+DIR=$(mktemp -d)
+trap 'kill $S 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+cat > cmds.txt << EOF
+-mfile healthy.txt -sensortype NTC -sensoraddress 10 -interval 1 -bus sim
+-mfile flaky.txt -sensortype NTC -sensoraddress 11 -interval 1 -bus sim -simfail 30 -retries 3 -backoff 5 -breaker 0
+-mfile broken.txt -sensortype NTC -sensoraddress 12 -interval 1 -bus sim -simfail 100 -retries 0 -breaker 2 -cooldown 1
+EOF
+# Trip and recover at random, each of them does both within the run with about 85 % chance
+for address in 20 21 22 23 24 25; do
+    echo "-mfile probe.txt -sensortype NTC -sensoraddress $address -interval 1 -bus sim -simfail 10 -retries 0 -breaker 1 -cooldown 1" >> cmds.txt
+done
+
+"$SM" -s -p 47400 -f cmds.txt -l s.log > /dev/null 2>&1 &
+S=$!
+sleep 14
+kill -TERM $S
+wait $S
+
+# Exit counters: "Sensor 0x.. <state>, readings: n, failures: n, retries: n, ..."
+counter () {
+    grep "Sensor $1 " "$2" | tail -n 1 | sed -n "s/.* $3: \([0-9]*\).*/\1/p"
+}
+
+fail () {
+    echo "FAIL: $1"
+    tail -n 5 healthy.txt flaky.txt broken.txt probe.txt
+    exit 1
+}
+
+[ "$(counter 0x10 healthy.txt failures)" = "0" ] || fail "healthy sensor has failures"
+[ "$(counter 0x10 healthy.txt readings)" -ge 10 ] || fail "healthy sensor missed readings"
+[ "$(counter 0x11 flaky.txt retries)" -gt 0 ] || fail "flaky sensor was not retried"
+grep -q ", -\{0,1\}[0-9][0-9]*, [^,]*$" flaky.txt || fail "flaky sensor has no values"
+[ "$(counter 0x12 broken.txt failures)" = "$(counter 0x12 broken.txt readings)" ] || fail "broken sensor has successful readings"
+[ "$(counter 0x12 broken.txt suspended)" -gt 1 ] || fail "broken sensor was not suspended again after a failed probe"
+[ "$(counter 0x12 broken.txt skipped)" -gt 0 ] || fail "suspended sensor was still read"
+grep -q "sensor suspended" probe.txt || fail "no suspend event in the log"
+grep -q "sensor resumed" probe.txt || fail "no resume event in the log"
+echo "OK: $(grep -h "Sensor 0x1[12] " flaky.txt broken.txt | sed 's/.*Sensor/Sensor/')"
@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Snapshot group on the simulated bus: three NTC sensors read together by
+# one process. Every snapshot must be one row with a value of every member
+# and the skew in us, and the statistics at exit must agree with the rows.
+#
+# Usage: group_snapshot.sh <sensormaster>
+
+SM=$1
+MEMBERS=3
+DIR=$(mktemp -d)
+trap 'kill $S 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+cat > cmds.txt << EOF
+-mfile g.txt -sensortype NTC -sensoraddress 20 -interval 1 -bus sim -group 1
+-sensortype NTC -sensoraddress 21 -interval 1 -bus sim -group 1
+-sensortype NTC -sensoraddress 22 -interval 1 -bus sim -group 1
+EOF
+
+"$SM" -s -p 48100 -f cmds.txt -l s.log > /dev/null 2>&1 &
+S=$!
+sleep 7
+kill -TERM $S
+wait $S
+
+fail () {
+    echo "FAIL: $1"
+    cat g.txt
+    exit 1
+}
+
+# Rows "time, value, unit, value, unit, value, unit, skew N us", the exit
+# lines "Sensor 0x20 active, readings: n, ..." and "Group 1 skew, mean: .."
+# follow the rows. Prints "rows max-skew".
+result=$(awk -F', ' -v members=$MEMBERS '
+    / active, readings: / || / Group [0-9]* skew, / { next }
+    {
+        rows++
+        if ( NF != 2 * members + 2 ) { print "FAIL: " NF " fields at line " NR ": " $0 > "/dev/stderr"; bad = 1; next }
+        for ( i = 2; i <= 2 * members; i += 2 ) {
+            if ( $i !~ /^[0-9]+$/ || $(i + 1) != "C" ) { print "FAIL: member " i / 2 " not read at line " NR ": " $0 > "/dev/stderr"; bad = 1 }
+        }
+        if ( $NF !~ /^skew [0-9]+ us$/ ) { print "FAIL: no skew at line " NR ": " $0 > "/dev/stderr"; bad = 1; next }
+        skew = $NF; sub ( /skew /, "", skew ); sub ( / us/, "", skew ); skew += 0
+        if ( skew > max ) max = skew
+    }
+    END { print rows + 0, max + 0; exit bad }' g.txt) || fail "invalid snapshot rows"
+set -- $result
+rows=$1
+skewMax=$2
+[ "$rows" -ge 5 ] || fail "$rows snapshots in 7 s"
+# The skew of the simulated bus is the time of two transfers, far below the interval
+[ "$skewMax" -lt 100000 ] || fail "skew of $skewMax us"
+
+# One snapshot a row, every member read once per snapshot
+summary=$(sed -n 's/.* Group 1 skew, mean: \([0-9]*\) us, max: \([0-9]*\) us, snapshots: \([0-9]*\)$/\1 \2 \3/p' g.txt)
+[ -n "$summary" ] || fail "no group statistics"
+set -- $summary
+[ "$3" = "$rows" ] || fail "$3 snapshots counted, $rows rows logged"
+[ "$2" = "$skewMax" ] || fail "max skew $2 us, rows show $skewMax us"
+[ "$1" -le "$2" ] || fail "mean skew $1 us above the max $2 us"
+for address in 20 21 22; do
+    grep -q "Sensor 0x$address active, readings: $rows," g.txt || fail "sensor 0x$address not read once per snapshot"
+done
+echo "OK: $rows snapshots of $MEMBERS members, max skew $2 us"
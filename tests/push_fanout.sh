@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Pushing commands to many boards: live servers on loopback, a port nobody
+# listens on and a server that is stopped, so its connections are never
+# accepted. Every live server must get the commands, the dead targets must
+# be reported failed within the push timeout and the exit code must say so.
+#
+# Usage: push_fanout.sh <sensormaster>
+
+SM=$1
+SERVERS=6
+TIMEOUT=3000
+DIR=$(mktemp -d)
+trap 'kill -CONT $STALLED 2>/dev/null; kill $PIDS $STALLED 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+# A server listens on its port and streams samples on the next one
+PIDS=
+: > targets.txt
+for i in $(seq $SERVERS); do
+    port=$(( 47700 + 2 * i ))
+    "$SM" -s -p $port -l s$port.log > /dev/null 2>&1 &
+    PIDS="$PIDS $!"
+    echo "127.0.0.1:$port" >> targets.txt
+done
+"$SM" -s -p 47790 -l stalled.log > /dev/null 2>&1 &
+STALLED=$!
+# Wait until every server listens (state 0A), a busy machine may take longer than a second
+for i in $(seq 50); do
+    listening=0
+    for port in $(cut -d : -f 2 targets.txt) 47790; do
+        grep -q ":$(printf "%04X" $port) [0-9A-F:]* 0A " /proc/net/tcp /proc/net/tcp6 2>/dev/null && listening=$(( listening + 1 ))
+    done
+    [ $listening -eq $(( SERVERS + 1 )) ] && break
+    sleep 0.1
+done
+kill -STOP $STALLED
+
+printf -- "-mfile m.txt -sensortype NTC -sensoraddress 10 -interval 1 -bus sim\n" > cmds.txt
+"$SM" -f cmds.txt -targets targets.txt -a 127.0.0.1:47798,127.0.0.1:47790 -parallel 3 -pushtimeout $TIMEOUT -l c.log > out.txt 2>&1
+status=$?
+cat out.txt
+
+fail () {
+    echo "FAIL: $1"
+    exit 1
+}
+
+[ $status -ne 0 ] || fail "exit code 0 with failed targets"
+for i in $(seq $SERVERS); do
+    port=$(( 47700 + 2 * i ))
+    grep -q "^127.0.0.1:$port  *ok " out.txt || fail "target $port not reported ok"
+    grep -q "Received command from: 127.0.0.1" s$port.log || fail "server $port did not log the commands"
+done
+# "name FAILED latency ms reason", within the timeout and a poll period
+for port in 47798 47790; do
+    latency=$(sed -n "s/^127.0.0.1:$port  *FAILED  *\([0-9]*\)\..*/\1/p" out.txt)
+    [ -n "$latency" ] || fail "target $port not reported failed"
+    [ "$latency" -le $(( TIMEOUT + 100 )) ] || fail "target $port failed only after $latency ms"
+done
+grep -q "^127.0.0.1:47798 .*refused" out.txt || fail "refused target not reported as refused"
+grep -q "^127.0.0.1:47790 .*did not close" out.txt || fail "stalled target not reported as not closing"
+grep -q "Commands sent to $SERVERS/$(( SERVERS + 2 )) targets" out.txt || fail "summary line missing"
+echo "OK: $SERVERS servers got the commands, refused and stalled targets failed"
@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# Alarm rules on a simulated NTC following a triangle wave (216, 217, 218,
+# 219, 218, 217, ...). The raised and cleared events must be exactly those
+# of the hysteresis and the N-of-M count worked out from the logged values,
+# and the command of an exec rule must run when its alarm clears.
+#
+# Usage: rules_alarm.sh <sensormaster>
+
+SM=$1
+DIR=$(mktemp -d)
+trap 'kill $S 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+printf -- "-mfile m.txt -sensortype NTC -sensoraddress 10 -interval 1 -bus sim -simwave 6\n" > cmds.txt
+# Without the hysteresis hot would clear at 218, without the count debounce would raise at 218
+cat > rules.txt << 'EOF'
+# Rules of the alarm test
+hot 10 above 218 clear 216 log
+debounce 10 above 217 count 2/3 exec echo "$ALARM_RULE $ALARM_STATE $ALARM_VALUE" >> exec.txt
+EOF
+
+"$SM" -s -p 48000 -f cmds.txt -rules rules.txt -alarmlog alarms.txt -l s.log > /dev/null 2>&1 &
+S=$!
+sleep 14
+kill -TERM $S
+wait $S
+
+fail () {
+    echo "FAIL: $1"
+    cat m.txt alarms.txt
+    exit 1
+}
+
+# Rows "time, value, unit"; same evaluation as the rules: an active alarm
+# compares against its clear level, n of the last m comparisons decide
+awk -F', ' '$3 == "C" {
+    v = $2 + 0
+    hot = ( hotActive ? v > 216 : v > 218 )
+    if ( hot != hotActive ) { print "hot " ( hot ? "raised" : "cleared" ) " " v; hotActive = hot }
+    h3 = h2; h2 = h1; h1 = ( v > 217 )
+    debounce = ( h1 + h2 + h3 >= 2 )
+    if ( debounce != debounceActive ) { print "debounce " ( debounce ? "raised" : "cleared" ) " " v; debounceActive = debounce }
+}' m.txt > expected.txt
+# "time, <rule> raised|cleared, sensor 0x10:0, value <v> C, latency ..."
+sed -n 's/^[^,]*, \([a-z]*\) \([a-z]*\), sensor 0x10:0, value \([0-9]*\) C, latency.*/\1 \2 \3/p' alarms.txt > events.txt
+
+[ "$(grep -c ", C$" m.txt)" -ge 10 ] || fail "too few readings"
+grep -q "hot cleared" expected.txt || fail "the wave did not go through a raise and a clear"
+cmp -s events.txt expected.txt || { diff events.txt expected.txt; fail "alarm events differ from the rules"; }
+grep -q "^hot cleared 216$" events.txt || fail "hysteresis: hot did not clear at its clear level"
+grep -q "^debounce raised 219$" events.txt || fail "count: debounce did not wait for the second hit"
+grep -q "^debounce cleared 216$" exec.txt || fail "exec action did not run on clear"
+[ "$(grep -c "^debounce" events.txt)" = "$(wc -l < exec.txt)" ] || fail "exec action did not run for every event"
+echo "OK: $(wc -l < events.txt) alarm events as expected, $(wc -l < exec.txt) commands run"
@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# Simulated SCD30: a clean sensor must deliver every measurement without
+# CRC errors; on sensors with corrupted transfers the CRC check must catch
+# every corruption, so only values in the range of the model get logged.
+#
+# Usage: scd30_crc.sh <sensormaster>
+
+SM=$1
+DIR=$(mktemp -d)
+trap 'kill $S 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+cat > cmds.txt << EOF
+-mfile clean.txt -sensortype SCC -sensoraddress 61 -bus sim
+-mfile bad62.txt -sensortype SCC -sensoraddress 62 -bus sim -simfail 25 -breaker 0
+-mfile bad63.txt -sensortype SCC -sensoraddress 63 -bus sim -simfail 25 -breaker 0
+EOF
+
+"$SM" -s -p 47500 -f cmds.txt -l s.log > /dev/null 2>&1 &
+S=$!
+sleep 14
+kill -TERM $S
+wait $S
+
+# Exit counters: "Sensor 0x.. <state>, readings: n, failures: n, retries: n, ..."
+counter () {
+    grep "Sensor $1 " "$2" | tail -n 1 | sed -n "s/.* $3: \([0-9]*\).*/\1/p"
+}
+
+fail () {
+    echo "FAIL: $1"
+    tail -n 8 clean.txt bad62.txt bad63.txt
+    exit 1
+}
+
+# Rows "time, CO2, ppm, temperature, C, humidity, %", the model stays within
+# 400-600 ppm, 22.5-24.5 C and 45-50 %
+values () {
+    awk -F', ' '$3 == "ppm" {
+        n++
+        if ( $2 < 400 || $2 >= 600 || $4 < 22.5 || $4 >= 24.5 || $6 < 45 || $6 >= 50 ) { print "implausible: " $0 > "/dev/stderr"; bad = 1 }
+    }
+    END { print n + 0; exit bad }' "$1"
+}
+
+n=$(values clean.txt) || fail "implausible value from the clean sensor"
+[ "$n" -ge 4 ] || fail "clean sensor logged only $n measurements"
+[ "$(counter 0x61 clean.txt crc\ errors)" = "0" ] || fail "CRC errors on the clean sensor"
+[ "$(counter 0x61 clean.txt failures)" = "0" ] || fail "failures on the clean sensor"
+
+n62=$(values bad62.txt) || fail "corrupted value passed the CRC check"
+n63=$(values bad63.txt) || fail "corrupted value passed the CRC check"
+[ $(( n62 + n63 )) -gt 0 ] || fail "no measurement got through the corrupted transfers"
+crc=$(( $(counter 0x62 bad62.txt crc\ errors) + $(counter 0x63 bad63.txt crc\ errors) ))
+[ $crc -gt 0 ] || fail "no CRC errors counted"
+echo "OK: clean $n measurements, corrupted $(( n62 + n63 )) measurements, $crc CRC errors"
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Non-interactive shutdown: SIGTERM to a fully loaded server, 16 sensors in
+# 14 processes: 12 single NTCs, a snapshot group of 3 and an SCD30. Every
+# process must drain within the drain deadline, none may be killed.
+#
+# Usage: shutdown_latency.sh <sensormaster>
+
+SM=$1
+DRAIN=1000
+DIR=$(mktemp -d)
+trap 'kill $S 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+: > cmds.txt
+for address in 10 11 12 13 14 15 16 17 18 19 1a 1b; do
+    echo "-sensortype NTC -sensoraddress $address -interval 1 -bus sim" >> cmds.txt
+done
+cat >> cmds.txt << EOF
+-sensortype NTC -sensoraddress 20 -interval 1 -bus sim -group 1
+-sensortype NTC -sensoraddress 21 -interval 1 -bus sim -group 1
+-sensortype NTC -sensoraddress 22 -interval 1 -bus sim -group 1
+-sensortype SCC -sensoraddress 61 -bus sim
+EOF
+
+"$SM" -s -p 47300 -f cmds.txt -drain $DRAIN -l s.log > /dev/null 2>&1 &
+S=$!
+# The master starts one process per tick, wait until all run and have measured
+for i in $(seq 30); do
+    [ "$(pgrep -c -P $S)" -ge 14 ] && break
+    sleep 1
+done
+sleep 2
+start=$(date +%s%N)
+kill -TERM $S
+wait $S
+status=$?
+elapsed=$(( ( $(date +%s%N) - start ) / 1000000 ))
+
+report=$(grep "Shutdown completed" s.log)
+echo "$report, exit in $elapsed ms"
+if [ -z "$report" ]; then
+    echo "FAIL: no shutdown report"
+    cat s.log
+    exit 1
+fi
+if [ $status -ne 0 ]; then
+    echo "FAIL: exit code $status"
+    exit 1
+fi
+if ! echo "$report" | grep -q "drained: 14/14, killed: 0"; then
+    echo "FAIL: not every process drained"
+    exit 1
+fi
+if [ $elapsed -ge $DRAIN ]; then
+    echo "FAIL: shutdown took $elapsed ms, drain deadline $DRAIN ms"
+    exit 1
+fi
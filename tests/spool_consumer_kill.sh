@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+# Store-and-forward spool: the consumer of the sample stream is killed,
+# the samples measured meanwhile must be replayed when it comes back,
+# in order and without gaps.
+#
+# Usage: spool_consumer_kill.sh <sensormaster>
+
+SM=$1
+DIR=$(mktemp -d)
+trap 'kill $S $C 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+printf -- "-sensortype NTC -sensoraddress 10 -interval 1 -bus sim\n-sensortype NTC -sensoraddress 11 -interval 1 -bus sim\n" > cmds.txt
+printf "127.0.0.1:47200\n" > boards.txt
+mkdir spool
+
+"$SM" -s -p 47200 -f cmds.txt -spool spool -l s.log > /dev/null 2>&1 &
+S=$!
+sleep 1
+"$SM" -collect boards.txt -store first.txt -window 200 -l c.log > /dev/null 2>&1 &
+C=$!
+sleep 2
+kill -KILL $C
+wait $C 2> /dev/null
+sleep 5									# Spooled while no consumer is connected
+"$SM" -collect boards.txt -store second.txt -window 200 -l c.log > /dev/null 2>&1 &
+C=$!
+sleep 4
+kill -TERM $C $S
+wait $C
+
+# Fields: time, board, address, channel, seq, value, unit
+for address in 0x10 0x11; do
+    if ! awk -F', ' -v a=$address '
+        $3 == a {
+            if ( n > 0 && $5 + 0 != last + 1 && $5 + 0 > last ) { print "FAIL: " a " seq " last " -> " $5; bad = 1 }
+            if ( n == 0 ) first = $5 + 0
+            if ( $5 + 0 > last ) last = $5 + 0
+            n++
+        }
+        END {
+            if ( n == 0 ) { print "FAIL: no samples of " a " after the restart"; exit 1 }
+            # The consumer was killed at about seq 3 and restarted at about seq 8
+            if ( first > 4 ) { print "FAIL: " a " replay starts at seq " first ", samples of the outage are missing"; bad = 1 }
+            exit bad
+        }' second.txt; then
+        cat second.txt
+        exit 1
+    fi
+done
+echo "OK: $(wc -l < second.txt) samples after the restart"
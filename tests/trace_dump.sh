@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# Event trace on request: SIGUSR1 to a running server must make the master
+# and every measuring process append their events to the trace file. The
+# file must be a Chrome trace (JSON array format) with a begin for every
+# end, both in the dump on request and after the dumps at exit.
+#
+# Usage: trace_dump.sh <sensormaster>
+
+SM=$1
+DIR=$(mktemp -d)
+trap 'kill $S 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR" || exit 1
+
+cat > cmds.txt << EOF
+-sensortype NTC -sensoraddress 10 -interval 1 -bus sim
+-sensortype NTC -sensoraddress 11 -interval 1 -bus sim -group 1
+-sensortype NTC -sensoraddress 12 -interval 1 -bus sim -group 1
+EOF
+
+fail () {
+    echo "FAIL: $1"
+    exit 1
+}
+
+# Every line an event object of the array; per process an end closes the
+# latest open begin of the same name. Prints "processes events open-begins".
+check () {
+    awk '
+        NR == 1 { if ( $0 != "[" ) { print "FAIL: line 1 is not the array start" > "/dev/stderr"; bad = 1 }; next }
+        !/^\{"name":"[^"]*","ph":"[BEMi]",("s":"p",)?("ts":[0-9]+\.[0-9][0-9][0-9],)?"pid":[0-9]+,"tid":[0-9]+(,"args":\{[^{}]*\})?\},$/ {
+            print "FAIL: not a trace event at line " NR ": " $0 > "/dev/stderr"; bad = 1; next
+        }
+        {
+            match ( $0, /"pid":[0-9]+/ ); pid = substr ( $0, RSTART + 6, RLENGTH - 6 )
+            match ( $0, /"ph":"."/ ); ph = substr ( $0, RSTART + 6, 1 )
+            match ( $0, /^\{"name":"[^"]*"/ ); name = substr ( $0, 10, RLENGTH - 10 )
+        }
+        ph == "M" { process[pid] = 1 }
+        ph == "i" { print "FAIL: " pid " dropped unmatched ends" > "/dev/stderr"; bad = 1 }
+        ph == "B" { stack[pid, ++depth[pid]] = name; events[pid]++ }
+        ph == "E" {
+            if ( depth[pid] == 0 || stack[pid, depth[pid]] != name ) { print "FAIL: unmatched end of " name " in " pid " at line " NR > "/dev/stderr"; bad = 1 }
+            else depth[pid]--
+            events[pid]++
+        }
+        END {
+            for ( p in process ) { n++; if ( events[p] > 0 ) traced++; open += depth[p] }
+            print traced + 0, n + 0, open + 0
+            exit bad
+        }' trace.json
+}
+
+"$SM" -s -p 47900 -f cmds.txt -trace trace.json -l s.log > /dev/null 2>&1 &
+S=$!
+sleep 4
+kill -USR1 $S
+sleep 2										# The master takes it on its tick, the children while waiting
+result=$(check) || fail "invalid trace after SIGUSR1"
+set -- $result
+[ "$1" -eq 3 ] || fail "events of $1 processes after SIGUSR1, expected the master and 2 measuring processes"
+grep -q '"args":{"name":"master"}' trace.json || fail "no master events"
+grep -q '"args":{"name":"group 1"}' trace.json || fail "no events of the group process"
+kill -TERM $S
+wait $S
+grep -q "Trace written to trace.json, events: [1-9][0-9]*, unmatched ends dropped: 0" s.log || fail "master did not log the dump"
+
+result=$(check) || fail "invalid trace after exit"
+set -- $result
+[ "$3" -eq 0 ] || fail "$3 phases never ended"
+echo "OK: $(grep -c '"ph":"[BE]"' trace.json) events of $1 processes, every end matched"